@@ -0,0 +1,535 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../libofs/libofs.h"
+
+/*
+ * Benchmark and load generator of the kernel module.
+ *
+ * For every scale (number of processes) a synthetic load is started: every
+ * process runs threads threads and holds files regular files, pipes pipes
+ * and sockets socket pairs (AF_UNIX, no network). Every query type is then
+ * performed iterations times; the latencies of the search ioctl, of every
+ * read() and of the whole search are reported as percentiles together with
+ * the throughput. The results are written as JSON (one document per run) so
+ * runs of different module versions can be compared.
+ */
+
+#define MAX_SCALES 16
+#define READ_BATCH 4096
+#define MODULE_SYSFS "/sys/module/openFileSearch/"
+
+struct config {
+	int scales[MAX_SCALES];
+	int scale_count;
+	int threads;
+	int files;
+	int pipes;
+	int sockets;
+	int iterations;
+	int warmup;
+	int proc_threads;
+	unsigned int mode;
+	const char *mode_names;
+	const char *output;
+};
+
+/*
+ * The processes of a synthetic load and the files they hold.
+ */
+struct load {
+	pid_t *children;
+	int count;
+	char dir[32];
+};
+
+struct query {
+	const char *name;
+	struct libofs_query query;
+};
+
+/*
+ * Latencies of one kind of operation in nanoseconds.
+ */
+struct samples {
+	unsigned long long *ns;
+	size_t count;
+	size_t capacity;
+};
+
+static unsigned long long now_ns(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void add_sample(struct samples *samples, unsigned long long ns) {
+	if (samples->count == samples->capacity) {
+		samples->capacity = samples->capacity ? 2 * samples->capacity : 1024;
+		samples->ns = realloc(samples->ns,
+				samples->capacity * sizeof(*samples->ns));
+		if (!samples->ns) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	samples->ns[samples->count++] = ns;
+}
+
+static int compare_ns(const void *a, const void *b) {
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+	return x < y ? -1 : x > y;
+}
+
+static unsigned long long percentile(const struct samples *samples,
+		double p) {
+	if (!samples->count) {
+		return 0;
+	}
+	size_t index = (size_t) (p / 100 * (samples->count - 1) + 0.5);
+	return samples->ns[index];
+}
+
+static void print_samples(FILE *out, const char *name,
+		struct samples *samples) {
+	unsigned long long sum = 0;
+
+	qsort(samples->ns, samples->count, sizeof(*samples->ns), compare_ns);
+	for (size_t i = 0; i < samples->count; i++) {
+		sum += samples->ns[i];
+	}
+	fprintf(out, "\"%s\": {\"count\": %zu, \"mean\": %llu, \"p50\": %llu, " \
+			"\"p90\": %llu, \"p99\": %llu, \"max\": %llu}", name,
+			samples->count, samples->count ? sum / samples->count : 0,
+			percentile(samples, 50), percentile(samples, 90),
+			percentile(samples, 99),
+			samples->count ? samples->ns[samples->count - 1] : 0);
+}
+
+/*
+ * The body of a load process: holds its files, pipes and sockets, starts
+ * its threads, reports readiness and sleeps until it is killed.
+ */
+static void *sleeper(void *arg) {
+	for (;;) {
+		pause();
+	}
+	return NULL;
+}
+
+static void load_process(const struct config *config, const char *dir,
+		int ready) {
+	char path[PATH_MAX];
+	struct rlimit limit;
+	int fds[2];
+	pthread_t thread;
+
+	// the mix may need more fds than the soft limit
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	for (int i = 0; i < config->files; i++) {
+		snprintf(path, sizeof(path), "%s/%d", dir, i);
+		if (open(path, O_RDONLY) < 0) {
+			perror("open");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < config->pipes; i++) {
+		if (pipe(fds)) {
+			perror("pipe");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < config->sockets; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+			perror("socketpair");
+			exit(1);
+		}
+	}
+	for (int i = 1; i < config->threads; i++) {
+		if (pthread_create(&thread, NULL, sleeper, NULL)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	if (write(ready, "", 1) != 1) {
+		exit(1);
+	}
+	sleeper(NULL);
+}
+
+static int load_start(struct load *load, const struct config *config,
+		int processes) {
+	char path[PATH_MAX];
+	int ready[2];
+	char byte;
+
+	strcpy(load->dir, "/tmp/ofs_benchXXXXXX");
+	if (!mkdtemp(load->dir)) {
+		perror("mkdtemp");
+		return -1;
+	}
+	for (int i = 0; i < config->files; i++) {
+		snprintf(path, sizeof(path), "%s/%d", load->dir, i);
+		int fd = open(path, O_WRONLY | O_CREAT, 0600);
+		if (fd < 0 || ftruncate(fd, 4096 * (i + 1))) {
+			perror("create");
+			return -1;
+		}
+		close(fd);
+	}
+
+	if (pipe(ready)) {
+		perror("pipe");
+		return -1;
+	}
+	load->children = calloc(processes, sizeof(pid_t));
+	load->count = 0;
+	for (int i = 0; i < processes; i++) {
+		pid_t child = fork();
+		if (child < 0) {
+			perror("fork");
+			break;
+		} else if (child == 0) {
+			close(ready[0]);
+			load_process(config, load->dir, ready[1]);
+		}
+		load->children[load->count++] = child;
+	}
+	close(ready[1]);
+	for (int i = 0; i < load->count; i++) {
+		if (read(ready[0], &byte, 1) != 1) {
+			fprintf(stderr, "load process failed\n");
+			close(ready[0]);
+			return -1;
+		}
+	}
+	close(ready[0]);
+	return load->count == processes ? 0 : -1;
+}
+
+static void load_stop(struct load *load, const struct config *config) {
+	char path[PATH_MAX];
+
+	for (int i = 0; i < load->count; i++) {
+		kill(load->children[i], SIGKILL);
+	}
+	while (wait(NULL) > 0) {
+	}
+	for (int i = 0; i < config->files; i++) {
+		snprintf(path, sizeof(path), "%s/%d", load->dir, i);
+		unlink(path);
+	}
+	rmdir(load->dir);
+	free(load->children);
+}
+
+/*
+ * Performs a query iterations times (after warmup untimed iterations) and
+ * writes its latencies as a JSON object.
+ */
+static int bench_query(FILE *out, struct libofs *ofs,
+		const struct config *config, const struct query *query) {
+	static struct ofs_result results[READ_BATCH];
+	struct samples ioctl_ns = { 0 };
+	struct samples read_ns = { 0 };
+	struct samples search_ns = { 0 };
+	unsigned long long total_ns = 0;
+	unsigned long long total_results = 0;
+	long count = 0;
+
+	for (int i = -config->warmup; i < config->iterations; i++) {
+		unsigned long long start = now_ns();
+		unsigned long long t;
+		ssize_t n;
+
+		if (libofs_search(ofs, &query->query)) {
+			if (errno == EOPNOTSUPP) {
+				fprintf(out, "{\"query\": \"%s\", \"supported\": false}",
+						query->name);
+				return 0;
+			}
+			fprintf(stderr, "[FAILED] %s: %s\n", query->name,
+					strerror(errno));
+			return -1;
+		}
+		t = now_ns();
+		if (i >= 0) {
+			add_sample(&ioctl_ns, t - start);
+		}
+		count = 0;
+		for (;;) {
+			unsigned long long read_start = now_ns();
+			n = libofs_read(ofs, results, READ_BATCH);
+			t = now_ns();
+			if (n <= 0) {
+				break;
+			}
+			if (i >= 0) {
+				add_sample(&read_ns, t - read_start);
+			}
+			count += n;
+		}
+		if (n < 0) {
+			fprintf(stderr, "[FAILED] %s: read: %s\n", query->name,
+					strerror(errno));
+			return -1;
+		}
+		if (i >= 0) {
+			add_sample(&search_ns, t - start);
+			total_ns += t - start;
+			total_results += count;
+		}
+	}
+
+	fprintf(out, "{\"query\": \"%s\", \"results\": %ld, ", query->name,
+			count);
+	print_samples(out, "ioctl_ns", &ioctl_ns);
+	fputs(", ", out);
+	print_samples(out, "read_ns", &read_ns);
+	fputs(", ", out);
+	print_samples(out, "search_ns", &search_ns);
+	fprintf(out, ", \"searches_per_s\": %.1f, \"results_per_s\": %.1f}",
+			total_ns ? config->iterations * 1e9 / total_ns : 0,
+			total_ns ? total_results * 1e9 / total_ns : 0);
+
+	fprintf(stderr, "  %-8s %8ld results, search p50 %10.3f ms, " \
+			"p99 %10.3f ms\n", query->name, count,
+			percentile(&search_ns, 50) / 1e6,
+			percentile(&search_ns, 99) / 1e6);
+	free(ioctl_ns.ns);
+	free(read_ns.ns);
+	free(search_ns.ns);
+	return 0;
+}
+
+static int bench_scale(FILE *out, struct libofs *ofs,
+		const struct config *config, int processes) {
+	struct load load;
+	char path[PATH_MAX];
+	int err = 0;
+
+	fprintf(stderr, "[ INFO ] %d processes x %d threads, %d files, " \
+			"%d pipes, %d sockets\n", processes, config->threads,
+			config->files, config->pipes, config->sockets);
+	if (load_start(&load, config, processes)) {
+		load_stop(&load, config);
+		return -1;
+	}
+
+	// the pid of a load process, the uid of the caller, one of the files
+	snprintf(path, sizeof(path), "%s/0", load.dir);
+	const struct query queries[] = {
+		{ "pid", libofs_query_pid(load.count ? load.children[0]
+				: getpid()) },
+		{ "uid", libofs_query_uid(getuid()) },
+		{ "owner", libofs_query_owner(getuid()) },
+		{ "name", libofs_query_name(path) },
+		{ "inode", libofs_query_inode(path) },
+		{ "subtree", libofs_query_subtree(load.dir) },
+		{ "all", libofs_query_all() },
+	};
+	size_t query_count = sizeof(queries) / sizeof(queries[0]);
+
+	fprintf(out, "    {\"processes\": %d, \"fds_per_process\": %d, " \
+			"\"queries\": [\n", processes,
+			config->files + 2 * config->pipes + 2 * config->sockets);
+	for (size_t i = 0; i < query_count && !err; i++) {
+		fputs("      ", out);
+		err = bench_query(out, ofs, config, &queries[i]);
+		fputs(i + 1 < query_count ? ",\n" : "\n", out);
+	}
+	fputs("    ]}", out);
+
+	load_stop(&load, config);
+	return err;
+}
+
+static void read_sysfs(const char *name, char *value, size_t size) {
+	FILE *file = fopen(name, "r");
+
+	strcpy(value, "unknown");
+	if (file) {
+		if (fgets(value, size, file)) {
+			value[strcspn(value, "\n")] = '\0';
+		}
+		fclose(file);
+	}
+}
+
+static int parse_modes(const char *names, unsigned int *mode) {
+	char *copy = strdup(names);
+	char *name;
+
+	*mode = 0;
+	for (name = strtok(copy, ","); name; name = strtok(NULL, ",")) {
+		if (strcmp("stream", name) == 0) {
+			*mode |= OFS_MODE_STREAM;
+		} else if (strcmp("parallel", name) == 0) {
+			*mode |= OFS_MODE_PARALLEL;
+		} else if (strcmp("lowlat", name) == 0) {
+			*mode |= OFS_MODE_LOWLAT;
+		} else if (strcmp("index", name) == 0) {
+			*mode |= OFS_MODE_INDEX;
+		} else if (strcmp("dedup", name) == 0) {
+			*mode |= OFS_MODE_DEDUP;
+		} else if (strcmp("default", name) != 0) {
+			fprintf(stderr, "Unknown mode %s\n", name);
+			free(copy);
+			return -1;
+		}
+	}
+	free(copy);
+	return 0;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ofs_bench [-n processes[,processes ...]] [-t threads] [-f files] [-p pipes]\n" \
+			"                 [-s sockets] [-i iterations] [-w warmup] [-m mode[,mode ...]] [-P proc_threads]\n" \
+			"                 [-o output.json]\n" \
+			"  defaults: -n 1,10,100 -t 1 -f 16 -p 4 -s 4 -i 20 -w 2 -m stream, JSON to stdout\n" \
+			"  -P benchmarks the /proc backend of libofs instead of the module\n");
+}
+
+int main(int argc, char **argv) {
+	struct config config = {
+		.scales = { 1, 10, 100 },
+		.scale_count = 3,
+		.threads = 1,
+		.files = 16,
+		.pipes = 4,
+		.sockets = 4,
+		.iterations = 20,
+		.warmup = 2,
+		.mode = OFS_MODE_STREAM,
+		.mode_names = "stream",
+	};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:f:p:s:i:w:m:o:P:")) != -1) {
+		switch (opt) {
+			case 'n': {
+				char *scale = strtok(optarg, ",");
+				for (config.scale_count = 0; scale
+						&& config.scale_count < MAX_SCALES;
+						scale = strtok(NULL, ",")) {
+					config.scales[config.scale_count++] = atoi(scale);
+				}
+				break;
+			}
+			case 't':
+				config.threads = atoi(optarg);
+				break;
+			case 'f':
+				config.files = atoi(optarg);
+				break;
+			case 'p':
+				config.pipes = atoi(optarg);
+				break;
+			case 's':
+				config.sockets = atoi(optarg);
+				break;
+			case 'i':
+				config.iterations = atoi(optarg);
+				break;
+			case 'w':
+				config.warmup = atoi(optarg);
+				break;
+			case 'm':
+				if (parse_modes(optarg, &config.mode)) {
+					return 2;
+				}
+				config.mode_names = optarg;
+				break;
+			case 'o':
+				config.output = optarg;
+				break;
+			case 'P':
+				config.proc_threads = atoi(optarg);
+				break;
+			default:
+				usage();
+				return 2;
+		}
+	}
+	if (config.files < 1 || config.iterations < 1 || config.threads < 1) {
+		usage();
+		return 2;
+	}
+
+	struct libofs ofs;
+	if (config.proc_threads > 0) {
+		// the user space baseline the module is compared against
+		if (libofs_open_proc(&ofs, config.proc_threads)) {
+			perror("open /proc");
+			return 1;
+		}
+		config.mode_names = "proc";
+	} else if (libofs_open(&ofs, config.mode)) {
+		fprintf(stderr, "[FAILED] open %s: %s\n", LIBOFS_DEVICE,
+				strerror(errno));
+		return 1;
+	}
+
+	FILE *out = config.output ? fopen(config.output, "w") : stdout;
+	if (!out) {
+		perror(config.output);
+		return 1;
+	}
+
+	char version[64];
+	char srcversion[64];
+	struct utsname host;
+	time_t now = time(NULL);
+	char timestamp[32];
+
+	read_sysfs(MODULE_SYSFS "version", version, sizeof(version));
+	read_sysfs(MODULE_SYSFS "srcversion", srcversion, sizeof(srcversion));
+	uname(&host);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ",
+			gmtime(&now));
+
+	fprintf(out, "{\n  \"module\": {\"version\": \"%s\", \"srcversion\": " \
+			"\"%s\"},\n", version, srcversion);
+	fprintf(out, "  \"host\": {\"kernel\": \"%s\", \"machine\": \"%s\", " \
+			"\"cpus\": %ld},\n", host.release, host.machine,
+			sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(out, "  \"timestamp\": \"%s\",\n", timestamp);
+	fprintf(out, "  \"config\": {\"mode\": \"%s\", \"threads\": %d, " \
+			"\"files\": %d, \"pipes\": %d, \"sockets\": %d, " \
+			"\"iterations\": %d, \"warmup\": %d, \"read_batch\": %d},\n",
+			config.mode_names, config.threads, config.files,
+			config.pipes, config.sockets, config.iterations,
+			config.warmup, READ_BATCH);
+	fputs("  \"runs\": [\n", out);
+
+	int err = 0;
+	for (int i = 0; i < config.scale_count && !err; i++) {
+		err = bench_scale(out, &ofs, &config, config.scales[i]);
+		fputs(i + 1 < config.scale_count ? ",\n" : "\n", out);
+	}
+	fputs("  ]\n}\n", out);
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	libofs_close(&ofs);
+	return err ? 1 : 0;
+}
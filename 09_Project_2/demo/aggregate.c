@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+/*
+ * Counts the open files matching a search command per uid, per process or
+ * per file with OFS_AGGREGATE and prints the groups with the most open
+ * files.
+ */
+static int compare_groups(const void *a, const void *b) {
+	const struct ofs_group *group_a = a;
+	const struct ofs_group *group_b = b;
+	return group_a->count < group_b->count ? 1
+		: group_a->count > group_b->count ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 4) {
+		printf("Usage: aggregate <uid|pid|file> <ioctl_cmd|ALL> <ioctl_arg> [capacity]\n");
+		return -1;
+	}
+
+	struct ofs_aggregate aggregate;
+	memset(&aggregate, 0, sizeof(aggregate));
+	if (strcmp("uid", argv[1]) == 0) {
+		aggregate.group_by = OFS_GROUP_BY_UID;
+	} else if (strcmp("pid", argv[1]) == 0) {
+		aggregate.group_by = OFS_GROUP_BY_PID;
+	} else if (strcmp("file", argv[1]) == 0) {
+		aggregate.group_by = OFS_GROUP_BY_FILE;
+	} else {
+		fprintf(stderr, "Unknown group %s\n", argv[1]);
+		return -1;
+	}
+
+	static struct query query;
+	if (parse_query(&query, argv[2], argv[3]) == 0) {
+		aggregate.ioctl_cmd = query.ioctl_cmd;
+		aggregate.ioctl_arg = (unsigned long) query_arg(&query);
+	} else {
+		return -1;
+	}
+
+	aggregate.capacity = argc > 4 ? atoi(argv[4]) : 4096;
+	struct ofs_group *groups = calloc(aggregate.capacity, sizeof(*groups));
+	if (!groups) {
+		perror("calloc");
+		return -1;
+	}
+	aggregate.groups = (unsigned long) groups;
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(fd, OFS_AGGREGATE, &aggregate)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_AGGREGATE: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("[  OK  ] ioctl OFS_AGGREGATE\n");
+
+	qsort(groups, aggregate.group_count, sizeof(*groups), compare_groups);
+	for (unsigned int i = 0; i < aggregate.group_count && i < 20; i++) {
+		struct ofs_group *group = &groups[i];
+		if (aggregate.group_by == OFS_GROUP_BY_FILE) {
+			printf("         - dev %u:%u inode %llu", major(group->dev),
+					minor(group->dev), group->key);
+		} else {
+			printf("         - %s %llu",
+					aggregate.group_by == OFS_GROUP_BY_UID ? "uid" : "pid",
+					group->key);
+		}
+		printf(": %llu open files, %llu bytes\n", group->count,
+				group->total_size);
+	}
+	if (aggregate.group_count > 20) {
+		printf("         ... %u more groups\n", aggregate.group_count - 20);
+	}
+
+	printf("[ INFO ] %llu open files in %u groups (%llu not counted)\n",
+			aggregate.matches, aggregate.group_count, aggregate.dropped);
+	printf("[ INFO ] %zu bytes copied instead of %zu for all results\n",
+			aggregate.group_count * sizeof(struct ofs_group),
+			(size_t) aggregate.matches * sizeof(struct ofs_result));
+
+	close(fd);
+	free(groups);
+	return 0;
+}
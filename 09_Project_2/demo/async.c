@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+#define MAX_QUERIES 16
+#define READ_BATCH 64
+
+/*
+ * Issues several searches in asynchronous mode (one open file each) from a
+ * single thread and collects their results with epoll as they arrive.
+ */
+int main(int argc, char **argv) {
+	if (argc < 3 || (argc - 1) % 2) {
+		printf("Usage: async <ioctl_cmd> <ioctl_arg> [<ioctl_cmd> <ioctl_arg> ...]\n");
+		return -1;
+	}
+
+	int query_count = (argc - 1) / 2;
+	if (query_count > MAX_QUERIES) {
+		fprintf(stderr, "At most %d queries\n", MAX_QUERIES);
+		return -1;
+	}
+
+	int epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0) {
+		fprintf(stderr, "[FAILED] epoll_create1: %s\n", strerror(errno));
+		return -1;
+	}
+
+	struct query queries[MAX_QUERIES];
+	unsigned long totals[MAX_QUERIES];
+	int fds[MAX_QUERIES];
+	struct timeval start, now;
+	gettimeofday(&start, NULL);
+
+	for (int i = 0; i < query_count; i++) {
+		char *cmd = argv[1 + 2 * i];
+		if (parse_query(&queries[i], cmd, argv[2 + 2 * i])) {
+			return -1;
+		}
+
+		fds[i] = open("/dev/openFileSearchDev", O_RDONLY | O_NONBLOCK);
+		if (fds[i] < 0) {
+			fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+			return -1;
+		}
+
+		unsigned int mode = OFS_MODE_ASYNC;
+		if (ioctl(fds[i], OFS_SET_MODE, &mode)) {
+			fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+			return -1;
+		}
+
+		// returns as soon as the search has been queued
+		if (ioctl(fds[i], queries[i].ioctl_cmd, query_arg(&queries[i]))) {
+			fprintf(stderr, "[FAILED] ioctl %s: %s\n", cmd, strerror(errno));
+			return -1;
+		}
+
+		struct epoll_event event = { .events = EPOLLIN, .data.u32 = i };
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event)) {
+			fprintf(stderr, "[FAILED] epoll_ctl: %s\n", strerror(errno));
+			return -1;
+		}
+		totals[i] = 0;
+	}
+	printf("[  OK  ] %d searches queued\n", query_count);
+
+	struct ofs_result results[READ_BATCH];
+	int pending = query_count;
+	while (pending) {
+		struct epoll_event events[MAX_QUERIES];
+		int event_count = epoll_wait(epoll_fd, events, MAX_QUERIES, -1);
+		if (event_count < 0) {
+			fprintf(stderr, "[FAILED] epoll_wait: %s\n", strerror(errno));
+			return -1;
+		}
+
+		for (int e = 0; e < event_count; e++) {
+			int i = events[e].data.u32;
+			int result_count;
+			while ((result_count = read(fds[i], results, READ_BATCH)) > 0) {
+				totals[i] += result_count;
+			}
+			if (result_count < 0 && errno == EAGAIN) {
+				// more results to come
+				continue;
+			}
+
+			gettimeofday(&now, NULL);
+			double elapsed = (now.tv_sec - start.tv_sec)
+				+ (now.tv_usec - start.tv_usec) / 1e6;
+			if (result_count < 0) {
+				fprintf(stderr, "[FAILED] read %s %s: %s\n", argv[1 + 2 * i],
+						argv[2 + 2 * i], strerror(errno));
+			} else {
+				printf("[  OK  ] %s %s: %lu results after %.3f s\n",
+						argv[1 + 2 * i], argv[2 + 2 * i], totals[i],
+						elapsed);
+			}
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fds[i], NULL);
+			close(fds[i]);
+			pending--;
+		}
+	}
+
+	close(epoll_fd);
+	return 0;
+}
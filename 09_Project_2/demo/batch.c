@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+#define MAX_RESULTS (64 * 1024)
+#define READ_BATCH 64
+
+/*
+ * Performs the same search command for many arguments (e.g. OFS_PID for all
+ * processes) once as a single OFS_BATCH and once as one ioctl() and read()
+ * per argument, and compares the times.
+ */
+static double elapsed_since(struct timeval *start) {
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec)
+		+ (end.tv_usec - start->tv_usec) / 1e6;
+}
+
+// the pids of all processes (from /proc)
+static int collect_pids(char ***args) {
+	DIR *proc = opendir("/proc");
+	struct dirent *entry;
+	int count = 0;
+
+	if (!proc) {
+		perror("opendir /proc");
+		return -1;
+	}
+	*args = malloc(OFS_MAX_BATCH * sizeof(char *));
+	while ((entry = readdir(proc)) && count < OFS_MAX_BATCH) {
+		if (isdigit(entry->d_name[0])) {
+			(*args)[count++] = strdup(entry->d_name);
+		}
+	}
+	closedir(proc);
+	return count;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		printf("Usage: batch <ioctl_cmd> <ioctl_arg|procs> [<ioctl_arg> ...]\n");
+		return -1;
+	}
+
+	char **args = &argv[2];
+	int query_count = argc - 2;
+	if (strcmp("procs", argv[2]) == 0
+			&& (query_count = collect_pids(&args)) < 0) {
+		return -1;
+	}
+	if (query_count > OFS_MAX_BATCH) {
+		fprintf(stderr, "At most %d queries\n", OFS_MAX_BATCH);
+		return -1;
+	}
+
+	struct query *queries = calloc(query_count, sizeof(*queries));
+	struct ofs_batch_query *batch_queries =
+		calloc(query_count, sizeof(*batch_queries));
+	struct ofs_batch_result *results =
+		calloc(MAX_RESULTS, sizeof(*results));
+	if (!queries || !batch_queries || !results) {
+		perror("calloc");
+		return -1;
+	}
+	for (int i = 0; i < query_count; i++) {
+		if (parse_query(&queries[i], argv[1], args[i])) {
+			return -1;
+		}
+		batch_queries[i].ioctl_cmd = queries[i].ioctl_cmd;
+		batch_queries[i].ioctl_arg = (unsigned long) query_arg(&queries[i]);
+	}
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	struct ofs_batch batch = {
+		.query_count = query_count,
+		.queries = (unsigned long) batch_queries,
+		.capacity = MAX_RESULTS,
+		.results = (unsigned long) results,
+	};
+	struct timeval start;
+	gettimeofday(&start, NULL);
+	if (ioctl(fd, OFS_BATCH, &batch)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_BATCH: %s\n", strerror(errno));
+		return -1;
+	}
+	double batch_time = elapsed_since(&start);
+	printf("[  OK  ] ioctl OFS_BATCH\n");
+
+	int failed = 0;
+	int truncated = 0;
+	for (unsigned int i = 0; i < batch.completed; i++) {
+		failed += batch_queries[i].error != 0;
+		truncated += batch_queries[i].truncated != 0;
+	}
+	for (unsigned int i = 0; i < batch.result_count && i < 10; i++) {
+		printf("         - query %u (%s): %s\n", results[i].query,
+				args[results[i].query], results[i].result.name);
+	}
+	printf("[ INFO ] %u/%d queries, %u results, %d failed, %d truncated " \
+			"in %.3f ms\n", batch.completed, query_count,
+			batch.result_count, failed, truncated, batch_time * 1e3);
+
+	// the same queries one at a time
+	struct ofs_result read_results[READ_BATCH];
+	unsigned long single_results = 0;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < query_count; i++) {
+		if (ioctl(fd, queries[i].ioctl_cmd, query_arg(&queries[i]))) {
+			continue;
+		}
+		int result_count;
+		while ((result_count = read(fd, read_results, READ_BATCH)) > 0) {
+			single_results += result_count;
+		}
+	}
+	double single_time = elapsed_since(&start);
+	printf("[ INFO ] %lu results one query at a time in %.3f ms\n",
+			single_results, single_time * 1e3);
+
+	close(fd);
+	return 0;
+}
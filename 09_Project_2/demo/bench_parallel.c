@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include "query.h"
+
+#define WORKERS_PARAM "/sys/module/openFileSearch/parameters/ofs_workers"
+
+/*
+ * Measures how the throughput of full system scans scales with the number
+ * of workers of OFS_MODE_PARALLEL. Requires write access to the module
+ * parameter ofs_workers.
+ */
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int set_workers(int workers) {
+	FILE *param = fopen(WORKERS_PARAM, "w");
+	if (!param) {
+		fprintf(stderr, "[FAILED] open %s: %s\n", WORKERS_PARAM, strerror(errno));
+		return -1;
+	}
+	fprintf(param, "%d\n", workers);
+	return fclose(param);
+}
+
+/*
+ * Runs the search iterations times and returns the elapsed time in seconds
+ * (or a negative value on failure).
+ */
+static double run_scans(int fd, unsigned int mode, struct query *query,
+		int iterations, unsigned long *results) {
+	struct ofs_result buffer[OFS_MAX_RESULTS];
+	int result_count;
+
+	if (ioctl(fd, OFS_SET_MODE, &mode)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+		return -1;
+	}
+
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		if (ioctl(fd, query->ioctl_cmd, query_arg(query))) {
+			fprintf(stderr, "[FAILED] ioctl: %s\n", strerror(errno));
+			return -1;
+		}
+		while ((result_count = read(fd, buffer, OFS_MAX_RESULTS)) > 0) {
+			*results += result_count;
+		}
+	}
+	return now() - start;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 5) {
+		printf("Usage: bench_parallel <ioctl_cmd> <ioctl_arg> <iterations> <max_workers>\n");
+		return -1;
+	}
+
+	struct query query;
+	if (parse_query(&query, argv[1], argv[2])) {
+		return -1;
+	}
+	int iterations = atoi(argv[3]);
+	int max_workers = atoi(argv[4]);
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	unsigned long results = 0;
+	double sequential = run_scans(fd, 0, &query, iterations, &results);
+	if (sequential < 0) {
+		return -1;
+	}
+	printf("%-10s %10s %12s %8s\n", "workers", "seconds", "scans/s", "speedup");
+	printf("%-10s %10.3f %12.1f %8.2f\n", "sequential", sequential,
+			iterations / sequential, 1.0);
+
+	for (int workers = 1; workers <= max_workers; workers *= 2) {
+		if (set_workers(workers)) {
+			return -1;
+		}
+		double elapsed = run_scans(fd, OFS_MODE_PARALLEL, &query,
+				iterations, &results);
+		if (elapsed < 0) {
+			return -1;
+		}
+		printf("%-10d %10.3f %12.1f %8.2f\n", workers, elapsed,
+				iterations / elapsed, sequential / elapsed);
+	}
+
+	close(fd);
+	return 0;
+}
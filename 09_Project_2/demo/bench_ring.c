@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include "query.h"
+
+#define DEFAULT_BATCH 10
+#define DEFAULT_RECORDS 4096
+
+/*
+ * Compares consuming the results of a search via read() (streaming mode)
+ * with consuming them from the shared ring (ring mode).
+ */
+struct bench_result {
+	unsigned long results;
+	unsigned long syscalls;
+	unsigned long checksum;
+	double seconds;
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int set_mode(int fd, unsigned int mode) {
+	if (ioctl(fd, OFS_SET_MODE, &mode)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_read(struct query *query, int iterations, int batch,
+		struct bench_result *bench) {
+	struct ofs_result *results = malloc(batch * sizeof(struct ofs_result));
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0 || !results || set_mode(fd, OFS_MODE_STREAM)) {
+		return -1;
+	}
+
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		if (ioctl(fd, query->ioctl_cmd, query_arg(query))) {
+			fprintf(stderr, "[FAILED] ioctl: %s\n", strerror(errno));
+			return -1;
+		}
+		bench->syscalls++;
+
+		int result_count;
+		while ((result_count = read(fd, results, batch)) > 0) {
+			bench->syscalls++;
+			for (int j = 0; j < result_count; j++) {
+				bench->checksum += results[j].inode_no;
+			}
+			bench->results += result_count;
+		}
+		bench->syscalls++;
+		if (result_count < 0) {
+			fprintf(stderr, "[FAILED] read: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	bench->seconds = now() - start;
+
+	free(results);
+	close(fd);
+	return 0;
+}
+
+static int bench_ring(struct query *query, int iterations, size_t records,
+		struct bench_result *bench) {
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+
+	size_t length = OFS_RING_HEADER_SIZE + records * sizeof(struct ofs_result);
+	void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "[FAILED] mmap: %s\n", strerror(errno));
+		return -1;
+	}
+	struct ofs_ring_header *ring = map;
+	struct ofs_result *ring_records =
+		(struct ofs_result *) ((char *) map + OFS_RING_HEADER_SIZE);
+	if (set_mode(fd, OFS_MODE_RING)) {
+		return -1;
+	}
+
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		if (ioctl(fd, query->ioctl_cmd, query_arg(query))) {
+			fprintf(stderr, "[FAILED] ioctl: %s\n", strerror(errno));
+			return -1;
+		}
+		bench->syscalls++;
+
+		unsigned int consumer = 0;
+		for (;;) {
+			unsigned int producer = __atomic_load_n(&ring->producer,
+					__ATOMIC_ACQUIRE);
+			for (; consumer != producer; consumer++) {
+				bench->checksum += ring_records[consumer
+					& (ring->size - 1)].inode_no;
+				bench->results++;
+			}
+			__atomic_store_n(&ring->consumer, consumer,
+					__ATOMIC_RELEASE);
+			if (__atomic_load_n(&ring->done, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+			if (ioctl(fd, OFS_RING_FILL) < 0) {
+				fprintf(stderr, "[FAILED] ioctl OFS_RING_FILL: %s\n", strerror(errno));
+				return -1;
+			}
+			bench->syscalls++;
+		}
+	}
+	bench->seconds = now() - start;
+
+	munmap(map, length);
+	close(fd);
+	return 0;
+}
+
+static void print_bench(const char *name, struct bench_result *bench) {
+	printf("%-6s %10lu results %8lu syscalls %9.3f s %12.0f results/s (checksum %lu)\n",
+			name, bench->results, bench->syscalls, bench->seconds,
+			bench->seconds > 0 ? bench->results / bench->seconds : 0,
+			bench->checksum);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 4) {
+		printf("Usage: bench_ring <ioctl_cmd> <ioctl_arg> <iterations> [batch] [records]\n");
+		return -1;
+	}
+
+	struct query query;
+	if (parse_query(&query, argv[1], argv[2])) {
+		return -1;
+	}
+	int iterations = atoi(argv[3]);
+	int batch = argc > 4 ? atoi(argv[4]) : DEFAULT_BATCH;
+	size_t records = argc > 5 ? atoi(argv[5]) : DEFAULT_RECORDS;
+
+	struct bench_result read_bench = { 0 };
+	struct bench_result ring_bench = { 0 };
+	if (bench_read(&query, iterations, batch, &read_bench)
+			|| bench_ring(&query, iterations, records, &ring_bench)) {
+		fprintf(stderr, "[FAILED] benchmark\n");
+		return -1;
+	}
+
+	print_bench("read", &read_bench);
+	print_bench("ring", &ring_bench);
+	return 0;
+}
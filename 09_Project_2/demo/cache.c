@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+#define READ_BATCH 256
+#define PARAMETERS "/sys/module/openFileSearch/parameters/"
+
+/*
+ * Repeats an OFS_UID or OFS_OWNER search with a new open() each time (like
+ * independent collectors) and prints the time of every search and the hit
+ * and miss counters of the result cache (module parameter
+ * ofs_cache_ttl_ms).
+ */
+static long read_counter(const char *name) {
+	char path[128];
+	long value = -1;
+
+	snprintf(path, sizeof(path), PARAMETERS "%s", name);
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		return -1;
+	}
+	if (fscanf(file, "%ld", &value) != 1) {
+		value = -1;
+	}
+	fclose(file);
+	return value;
+}
+
+static int search(struct query *query) {
+	static struct ofs_result results[READ_BATCH];
+	int total = 0;
+	int result_count;
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+	if (ioctl(fd, query->ioctl_cmd, query_arg(query))) {
+		fprintf(stderr, "[FAILED] search: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	while ((result_count = read(fd, results, READ_BATCH)) > 0) {
+		total += result_count;
+	}
+	close(fd);
+	return result_count < 0 ? -1 : total;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 4) {
+		printf("Usage: cache <OFS_UID|OFS_OWNER> <ioctl_arg> <iterations> [interval_ms]\n");
+		return -1;
+	}
+
+	static struct query query;
+	if (parse_query(&query, argv[1], argv[2])) {
+		return -1;
+	}
+	int iterations = atoi(argv[3]);
+	int interval_ms = argc > 4 ? atoi(argv[4]) : 0;
+
+	printf("[ INFO ] ofs_cache_ttl_ms: %ld\n", read_counter("ofs_cache_ttl_ms"));
+	long hits = read_counter("ofs_cache_hits");
+	long misses = read_counter("ofs_cache_misses");
+
+	for (int i = 0; i < iterations; i++) {
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+		int count = search(&query);
+		gettimeofday(&end, NULL);
+		if (count < 0) {
+			return -1;
+		}
+		printf("[ INFO ] search %d: %d results in %.3f ms\n", i + 1, count,
+				((end.tv_sec - start.tv_sec) * 1e6
+				 + (end.tv_usec - start.tv_usec)) / 1e3);
+		if (interval_ms) {
+			usleep(interval_ms * 1000);
+		}
+	}
+
+	printf("[ INFO ] cache hits: %ld, misses: %ld\n",
+			read_counter("ofs_cache_hits") - hits,
+			read_counter("ofs_cache_misses") - misses);
+	return 0;
+}
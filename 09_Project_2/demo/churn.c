@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "../openFileSearch.h"
+
+#define READ_BATCH 256
+
+/*
+ * Load test of OFS_SUBSCRIBE: churners open() and close() a temporary file
+ * as fast as they can while a subscription to the file's inode collects the
+ * events. Every open and close must either be received as an event or be
+ * reported as lost.
+ */
+struct counters {
+	unsigned long opens;
+	unsigned long closes;
+};
+
+static void churn(const char *path, double seconds, struct counters *counters) {
+	struct timeval start, now;
+	gettimeofday(&start, NULL);
+
+	do {
+		// check the time only every 1024 iterations
+		for (int i = 0; i < 1024; i++) {
+			int fd = open(path, O_RDONLY);
+			if (fd < 0) {
+				perror("open");
+				exit(1);
+			}
+			counters->opens++;
+			close(fd);
+			counters->closes++;
+		}
+		gettimeofday(&now, NULL);
+	} while ((now.tv_sec - start.tv_sec)
+			+ (now.tv_usec - start.tv_usec) / 1e6 < seconds);
+}
+
+static void count_events(struct ofs_event *events, int event_count,
+		unsigned long *opens, unsigned long *closes, unsigned long *lost) {
+	for (int i = 0; i < event_count; i++) {
+		switch (events[i].type) {
+			case OFS_EVENT_OPEN:
+				(*opens)++;
+				break;
+			case OFS_EVENT_CLOSE:
+				(*closes)++;
+				break;
+			case OFS_EVENT_LOST:
+				*lost += events[i].lost;
+				break;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		printf("Usage: churn <churners> <seconds>\n");
+		return -1;
+	}
+
+	int churners = atoi(argv[1]);
+	double seconds = atof(argv[2]);
+
+	char path[] = "/tmp/ofs_churn_XXXXXX";
+	int tmp_fd = mkstemp(path);
+	if (tmp_fd < 0) {
+		perror("mkstemp");
+		return -1;
+	}
+	close(tmp_fd);
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	struct ofs_subscribe subscribe = {
+		.ioctl_cmd = OFS_INODE,
+		.ioctl_arg = (unsigned long) path,
+	};
+	if (ioctl(fd, OFS_SUBSCRIBE, &subscribe)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SUBSCRIBE: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("[  OK  ] subscribed to %s\n", path);
+
+	struct counters *counters = mmap(NULL, churners * sizeof(*counters),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (counters == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < churners; i++) {
+		pid_t child = fork();
+		if (child < 0) {
+			perror("fork");
+			return -1;
+		} else if (child == 0) {
+			close(fd);
+			churn(path, seconds, &counters[i]);
+			exit(0);
+		}
+	}
+
+	static struct ofs_event events[READ_BATCH];
+	unsigned long opens = 0;
+	unsigned long closes = 0;
+	unsigned long lost = 0;
+	int running = churners;
+	struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+	while (running) {
+		if (poll(&pollfd, 1, 100) > 0) {
+			int event_count = read(fd, events, READ_BATCH);
+			if (event_count < 0) {
+				fprintf(stderr, "[FAILED] read: %s\n", strerror(errno));
+				return -1;
+			}
+			count_events(events, event_count, &opens, &closes, &lost);
+		}
+		while (running && waitpid(-1, NULL, WNOHANG) > 0) {
+			running--;
+		}
+	}
+	gettimeofday(&end, NULL);
+
+	// drain the remaining events
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	int event_count;
+	while ((event_count = read(fd, events, READ_BATCH)) > 0) {
+		count_events(events, event_count, &opens, &closes, &lost);
+	}
+	close(fd);
+	unlink(path);
+
+	unsigned long churned = 0;
+	for (int i = 0; i < churners; i++) {
+		churned += counters[i].opens + counters[i].closes;
+	}
+	double elapsed = (end.tv_sec - start.tv_sec)
+		+ (end.tv_usec - start.tv_usec) / 1e6;
+	printf("[ INFO ] %lu opens/closes in %.3f s (%.0f/s)\n", churned,
+			elapsed, churned / elapsed);
+	printf("[ INFO ] %lu open events, %lu close events, %lu lost\n",
+			opens, closes, lost);
+
+	if (opens + closes + lost != churned) {
+		printf("[FAILED] %lu events missing\n",
+				churned - (opens + closes + lost));
+		return 1;
+	}
+	printf("[  OK  ] churn\n");
+	return 0;
+}
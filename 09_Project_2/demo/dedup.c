@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "../openFileSearch.h"
+
+#define READ_BATCH 256
+#define STACK_SIZE (64 * 1024)
+
+/*
+ * Shows the effect of OFS_MODE_DEDUP: a temporary file is held by a fd
+ * table shared by several processes (clone() with CLONE_FILES) via several
+ * dup()ed fds, and by a thread with an unshared fd table. The file is
+ * searched (OFS_INODE) with and without de-duplication.
+ *
+ * Without de-duplication the shared fd table is searched once per process
+ * and every fd is returned, the thread is not found. With de-duplication
+ * the shared fd table returns the file once and the thread is found.
+ */
+static int sleeper(void *arg) {
+	pause();
+	return 0;
+}
+
+static void *unshared_thread(void *path) {
+	if (unshare(CLONE_FILES)) {
+		perror("unshare");
+		return NULL;
+	}
+	if (open(path, O_RDONLY) < 0) {
+		perror("open");
+		return NULL;
+	}
+	pause();
+	return NULL;
+}
+
+static int search(int fd, unsigned int mode, const char *path) {
+	static struct ofs_result results[READ_BATCH];
+	int total = 0;
+	int result_count;
+	struct timeval start, end;
+
+	mode |= OFS_MODE_STREAM;
+	if (ioctl(fd, OFS_SET_MODE, &mode)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+		return -1;
+	}
+	gettimeofday(&start, NULL);
+	if (ioctl(fd, OFS_INODE, path)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_INODE: %s\n", strerror(errno));
+		return -1;
+	}
+	while ((result_count = read(fd, results, READ_BATCH)) > 0) {
+		total += result_count;
+	}
+	gettimeofday(&end, NULL);
+	printf("[ INFO ] %-10s %d results in %.3f ms\n",
+			mode & OFS_MODE_DEDUP ? "dedup:" : "default:", total,
+			((end.tv_sec - start.tv_sec) * 1e6
+			 + (end.tv_usec - start.tv_usec)) / 1e3);
+	return total;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		printf("Usage: dedup <sharers> <dups>\n");
+		return -1;
+	}
+
+	int sharers = atoi(argv[1]);
+	int dups = atoi(argv[2]);
+
+	char path[] = "/tmp/ofs_dedup_XXXXXX";
+	int file_fd = mkstemp(path);
+	if (file_fd < 0) {
+		perror("mkstemp");
+		return -1;
+	}
+	for (int i = 1; i < dups; i++) {
+		if (dup(file_fd) < 0) {
+			perror("dup");
+			return -1;
+		}
+	}
+
+	// processes sharing this process's fd table
+	pid_t *children = calloc(sharers, sizeof(*children));
+	for (int i = 0; i < sharers; i++) {
+		char *stack = malloc(STACK_SIZE);
+		children[i] = clone(sleeper, stack + STACK_SIZE,
+				CLONE_FILES | SIGCHLD, NULL);
+		if (children[i] < 0) {
+			perror("clone");
+			return -1;
+		}
+	}
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, unshared_thread, path);
+	usleep(100 * 1000);
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+	int plain = search(fd, 0, path);
+	int dedup = search(fd, OFS_MODE_DEDUP, path);
+	close(fd);
+
+	for (int i = 0; i < sharers; i++) {
+		kill(children[i], SIGKILL);
+		waitpid(children[i], NULL, 0);
+	}
+	unlink(path);
+
+	// (sharers + 1) x dups vs. 1 + the unshared thread
+	printf("[ INFO ] expected %d and 2 results\n", (sharers + 1) * dups);
+	if (plain < 0 || dedup != 2) {
+		printf("[FAILED] dedup\n");
+		return 1;
+	}
+	printf("[  OK  ] dedup\n");
+	return 0;
+}
@@ -12,7 +12,7 @@
 
 int main(int argc, char **argv) {
 	if (argc < 3) {
-		printf("Usage: demo <ioctl_cmd> <ioctl_arg>\n");
+		printf("Usage: demo <ioctl_cmd> <ioctl_arg> [stream|parallel|lowlat|async|dedup ...]\n");
 		return -1;
 	}
 
@@ -24,6 +24,30 @@ int main(int argc, char **argv) {
 	printf("[  OK  ] open\n");
 	printf("[ INFO ] current pid: %d\n", getpid());
 
+	unsigned int mode = 0;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp("stream", argv[i]) == 0) {
+			mode |= OFS_MODE_STREAM;
+		} else if (strcmp("parallel", argv[i]) == 0) {
+			mode |= OFS_MODE_PARALLEL;
+		} else if (strcmp("lowlat", argv[i]) == 0) {
+			mode |= OFS_MODE_LOWLAT;
+		} else if (strcmp("async", argv[i]) == 0) {
+			mode |= OFS_MODE_ASYNC;
+		} else if (strcmp("dedup", argv[i]) == 0) {
+			mode |= OFS_MODE_DEDUP;
+		} else {
+			fprintf(stderr, "Unknown mode %s\n", argv[i]);
+		}
+	}
+	if (mode) {
+		if (ioctl(fd, OFS_SET_MODE, &mode)) {
+			fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+			return -1;
+		}
+		printf("[  OK  ] ioctl OFS_SET_MODE (0x%x)\n", mode);
+	}
+
 	char *ioctl_cmd_str = argv[1];
 	int ioctl_cmd;
 	unsigned int uint_arg;
@@ -45,6 +69,14 @@ int main(int argc, char **argv) {
 		ioctl_cmd = OFS_NAME;
 		str_arg = argv[2];
 		ioctl_arg = str_arg;
+	} else if (strcmp("OFS_INODE", ioctl_cmd_str) == 0) {
+		ioctl_cmd = OFS_INODE;
+		str_arg = argv[2];
+		ioctl_arg = str_arg;
+	} else if (strcmp("OFS_SUBTREE", ioctl_cmd_str) == 0) {
+		ioctl_cmd = OFS_SUBTREE;
+		str_arg = argv[2];
+		ioctl_arg = str_arg;
 	} else {
 		fprintf(stderr, "Unknown ioctl command %s\n", ioctl_cmd_str);
 	}
@@ -73,6 +105,15 @@ int main(int argc, char **argv) {
 		} else {
 			printf("[  OK  ] read\n");
 		}
+
+		struct ofs_stats stats;
+		if (ioctl(fd, OFS_STATS, &stats) == 0) {
+			printf("[ INFO ] max lock hold time: %llu ns (%llu lock sections)\n",
+					stats.max_lock_ns, stats.lock_sections);
+			printf("[ INFO ] %llu tasks, %llu fds, %llu d_path calls, %llu rejected, %llu truncated names in %llu ns\n",
+					stats.tasks, stats.fds, stats.d_path_calls, stats.rejected,
+					stats.truncated_names, stats.scan_ns);
+		}
 	}
 
 	if (close(fd)) {
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+/*
+ * Checks the open file index (module parameter ofs_index=1): compares the
+ * index with a full scan in the kernel (OFS_INDEX_CHECK) and, if a query is
+ * given, compares its results served from the index with the results of a
+ * full scan.
+ */
+static int compare_results(const void *a, const void *b) {
+	const struct ofs_result *x = a;
+	const struct ofs_result *y = b;
+
+	if (x->pid != y->pid) {
+		return x->pid < y->pid ? -1 : 1;
+	}
+	if (x->inode_no != y->inode_no) {
+		return x->inode_no < y->inode_no ? -1 : 1;
+	}
+	return strcmp(x->name, y->name);
+}
+
+static int search(int fd, unsigned int mode, struct query *query,
+		struct ofs_result *results) {
+	if (ioctl(fd, OFS_SET_MODE, &mode)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+		return -1;
+	}
+	if (ioctl(fd, query->ioctl_cmd, query_arg(query))) {
+		fprintf(stderr, "[FAILED] search: %s\n", strerror(errno));
+		return -1;
+	}
+
+	int total = 0;
+	int result_count;
+	while ((result_count = read(fd, results + total,
+					OFS_MAX_RESULTS - total)) > 0) {
+		total += result_count;
+	}
+	if (result_count < 0) {
+		fprintf(stderr, "[FAILED] read: %s\n", strerror(errno));
+		return -1;
+	}
+	qsort(results, total, sizeof(struct ofs_result), compare_results);
+	return total;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 1 && argc != 2 && argc != 3) {
+		printf("Usage: index_check [repair | <ioctl_cmd> <ioctl_arg>]\n");
+		return -1;
+	}
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	struct ofs_index_check check;
+	memset(&check, 0, sizeof(check));
+	check.repair = argc == 2 && strcmp("repair", argv[1]) == 0;
+	if (ioctl(fd, OFS_INDEX_CHECK, &check)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_INDEX_CHECK: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("[ INFO ] %llu fds scanned, %llu indexed\n", check.scanned,
+			check.indexed);
+	printf("[ INFO ] %llu missing, %llu stale, %llu mismatched, %llu lost%s\n",
+			check.missing, check.stale, check.mismatched, check.lost,
+			check.repair ? " (repaired)" : "");
+	int failed = check.missing || check.stale || check.mismatched;
+
+	if (argc == 3) {
+		struct query query;
+		if (parse_query(&query, argv[1], argv[2])) {
+			return -1;
+		}
+
+		static struct ofs_result scanned[OFS_MAX_RESULTS];
+		static struct ofs_result indexed[OFS_MAX_RESULTS];
+		int scanned_count = search(fd, 0, &query, scanned);
+		int indexed_count = search(fd, OFS_MODE_INDEX, &query, indexed);
+		if (scanned_count < 0 || indexed_count < 0) {
+			return -1;
+		}
+
+		printf("[ INFO ] %s %s: %d results scanned, %d from the index\n",
+				argv[1], argv[2], scanned_count, indexed_count);
+		if (scanned_count != indexed_count) {
+			failed = 1;
+		}
+		for (int i = 0; !failed && i < scanned_count; i++) {
+			if (compare_results(&scanned[i], &indexed[i])) {
+				printf("[ INFO ] first difference: %s (pid %d)\n",
+						scanned[i].name, scanned[i].pid);
+				failed = 1;
+			}
+		}
+	}
+
+	close(fd);
+	if (failed) {
+		printf("[FAILED] index differs from a full scan\n");
+		return 1;
+	}
+	printf("[  OK  ] index consistent\n");
+	return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "../openFileSearch.h"
+
+/*
+ * A search command and its argument as passed to ioctl().
+ */
+struct query {
+	int ioctl_cmd;
+	unsigned int uint_arg;
+	char name_arg[PATH_MAX];
+	struct ofs_program program_arg;
+};
+
+static inline void *query_arg(struct query *query) {
+	if (query->ioctl_cmd == OFS_PROGRAM) {
+		return &query->program_arg;
+	}
+	return query->ioctl_cmd == OFS_NAME || query->ioctl_cmd == OFS_INODE
+		|| query->ioctl_cmd == OFS_SUBTREE
+		? (void *) query->name_arg : (void *) &query->uint_arg;
+}
+
+/*
+ * Parses a search command (OFS_PID, OFS_UID, OFS_OWNER, OFS_NAME, OFS_INODE
+ * or OFS_SUBTREE) and its argument. "ALL" matches every open file (an
+ * OFS_PROGRAM whose only instruction is always true, the argument is
+ * ignored). Returns 0 on success and -1 (after printing the error) for an
+ * unknown command or a name or path that is too long: the kernel only
+ * accepts names shorter than OFS_RESULT_NAME_MAX_LENGTH, a truncated name
+ * would search for another file.
+ */
+static inline int parse_query(struct query *query, const char *cmd,
+		const char *arg) {
+	memset(query, 0, sizeof(*query));
+	if (strcmp("OFS_PID", cmd) == 0) {
+		query->ioctl_cmd = OFS_PID;
+	} else if (strcmp("OFS_UID", cmd) == 0) {
+		query->ioctl_cmd = OFS_UID;
+	} else if (strcmp("OFS_OWNER", cmd) == 0) {
+		query->ioctl_cmd = OFS_OWNER;
+	} else if (strcmp("OFS_NAME", cmd) == 0) {
+		query->ioctl_cmd = OFS_NAME;
+		if (strlen(arg) >= OFS_RESULT_NAME_MAX_LENGTH) {
+			fprintf(stderr, "Name must be shorter than %d " \
+					"characters\n",
+					OFS_RESULT_NAME_MAX_LENGTH);
+			return -1;
+		}
+		strcpy(query->name_arg, arg);
+		return 0;
+	} else if (strcmp("ALL", cmd) == 0) {
+		// (open flags & 0) == 0 is true for every open file
+		query->ioctl_cmd = OFS_PROGRAM;
+		query->program_arg.length = 1;
+		query->program_arg.insns[0].op = OFS_OP_FLAGS;
+		return 0;
+	} else if (strcmp("OFS_INODE", cmd) == 0
+			|| strcmp("OFS_SUBTREE", cmd) == 0) {
+		query->ioctl_cmd = strcmp("OFS_INODE", cmd) == 0
+			? OFS_INODE : OFS_SUBTREE;
+		if (strlen(arg) >= PATH_MAX) {
+			fprintf(stderr, "Path must be shorter than %d " \
+					"characters\n", PATH_MAX);
+			return -1;
+		}
+		strcpy(query->name_arg, arg);
+		return 0;
+	} else {
+		fprintf(stderr, "Unknown ioctl command %s\n", cmd);
+		return -1;
+	}
+	query->uint_arg = atoi(arg);
+	return 0;
+}
+
+#endif
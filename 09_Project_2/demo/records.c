@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+#define DEFAULT_BUFFER_SIZE (64 * 1024)
+
+/*
+ * Prints the typed part of a record of a socket or pipe (OFS_MODE_TYPED).
+ */
+static void print_typed(const struct ofs_record *record) {
+	const void *typed = OFS_RECORD_TYPED(record);
+	char local[INET6_ADDRSTRLEN];
+	char remote[INET6_ADDRSTRLEN];
+
+	if (!typed) {
+		return;
+	}
+	if (S_ISSOCK(record->mode)) {
+		const struct ofs_socket *sock = typed;
+		printf("              socket:[%llu] family: %u, type: %u, protocol: %u, state: %u",
+				record->inode_no, sock->family, sock->type,
+				sock->protocol, sock->state);
+		if (sock->family == AF_INET || sock->family == AF_INET6) {
+			inet_ntop(sock->family, sock->local_addr, local,
+					sizeof(local));
+			inet_ntop(sock->family, sock->remote_addr, remote,
+					sizeof(remote));
+			printf(", local: %s:%u, remote: %s:%u", local,
+					sock->local_port, remote, sock->remote_port);
+		} else if (sock->family == AF_UNIX && sock->peer_inode) {
+			printf(", peer: socket:[%llu]", sock->peer_inode);
+		}
+		printf("\n");
+	} else if (S_ISFIFO(record->mode)) {
+		const struct ofs_pipe *pipe = typed;
+		printf("              pipe:[%llu] end: %s%s, readers: %u, writers: %u, buffers: %u\n",
+				record->inode_no,
+				pipe->end & OFS_PIPE_READ ? "r" : "",
+				pipe->end & OFS_PIPE_WRITE ? "w" : "",
+				pipe->readers, pipe->writers, pipe->buffers);
+	}
+}
+
+/*
+ * Performs a single search in v2 mode (optionally typed) and prints all
+ * records with their full paths or typed parts. Compares the number of
+ * bytes read with the size of the same results as struct ofs_result.
+ */
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		printf("Usage: records <ioctl_cmd> <ioctl_arg> [buffer_size] [typed]\n");
+		return -1;
+	}
+
+	static struct query query;
+	if (parse_query(&query, argv[1], argv[2])) {
+		return -1;
+	}
+	size_t buffer_size = argc > 3 ? atoi(argv[3]) : DEFAULT_BUFFER_SIZE;
+	char *buffer = malloc(buffer_size);
+	if (!buffer) {
+		perror("malloc");
+		return -1;
+	}
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	unsigned int mode = OFS_MODE_V2;
+	if (argc > 4 && strcmp("typed", argv[4]) == 0) {
+		mode |= OFS_MODE_TYPED;
+	}
+	if (ioctl(fd, OFS_SET_MODE, &mode)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(fd, query.ioctl_cmd, query_arg(&query))) {
+		fprintf(stderr, "[FAILED] ioctl %s: %s\n", argv[1], strerror(errno));
+		return -1;
+	}
+	printf("[  OK  ] ioctl %s\n", argv[1]);
+
+	unsigned long record_count = 0;
+	unsigned long total_bytes = 0;
+	ssize_t read_bytes;
+	while ((read_bytes = read(fd, buffer, buffer_size)) > 0) {
+		for (ssize_t offset = 0; offset < read_bytes;) {
+			struct ofs_record *record =
+				(struct ofs_record *) (buffer + offset);
+			printf("         - %s\n              pid: %u, uid: %u, owner: %u, mode: %o, flags: 0%o, dev: %u:%u, fsize: %llu, inode_no: %llu, pos: %llu\n",
+					record->path, record->pid, record->uid,
+					record->owner, record->mode, record->flags,
+					major(record->dev), minor(record->dev),
+					record->fsize, record->inode_no, record->pos);
+			print_typed(record);
+			offset += record->size;
+			record_count++;
+		}
+		total_bytes += read_bytes;
+	}
+	if (read_bytes < 0) {
+		fprintf(stderr, "[FAILED] read: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("[  OK  ] read\n");
+	printf("[ INFO ] %lu records in %lu bytes (%lu bytes as struct ofs_result)\n",
+			record_count, total_bytes,
+			record_count * sizeof(struct ofs_result));
+
+	close(fd);
+	free(buffer);
+	return 0;
+}
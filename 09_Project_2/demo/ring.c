@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+#define DEFAULT_RECORDS 1024
+
+/*
+ * Performs a single search in ring mode and prints all results. Records are
+ * consumed directly from the shared ring; a syscall is only needed when the
+ * ring has been drained.
+ */
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		printf("Usage: ring <ioctl_cmd> <ioctl_arg> [records]\n");
+		return -1;
+	}
+
+	struct query query;
+	if (parse_query(&query, argv[1], argv[2])) {
+		return -1;
+	}
+	size_t records = argc > 3 ? atoi(argv[3]) : DEFAULT_RECORDS;
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	size_t length = OFS_RING_HEADER_SIZE + records * sizeof(struct ofs_result);
+	void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "[FAILED] mmap: %s\n", strerror(errno));
+		return -1;
+	}
+	struct ofs_ring_header *ring = map;
+	struct ofs_result *ring_records =
+		(struct ofs_result *) ((char *) map + OFS_RING_HEADER_SIZE);
+	printf("[  OK  ] mmap (%u records)\n", ring->size);
+
+	unsigned int mode = OFS_MODE_RING;
+	if (ioctl(fd, OFS_SET_MODE, &mode)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(fd, query.ioctl_cmd, query_arg(&query))) {
+		fprintf(stderr, "[FAILED] ioctl %s: %s\n", argv[1], strerror(errno));
+		return -1;
+	}
+	printf("[  OK  ] ioctl %s\n", argv[1]);
+
+	unsigned long total = 0;
+	unsigned long refills = 0;
+	unsigned int consumer = 0;
+	for (;;) {
+		unsigned int producer = __atomic_load_n(&ring->producer,
+				__ATOMIC_ACQUIRE);
+		for (; consumer != producer; consumer++) {
+			struct ofs_result *result =
+				&ring_records[consumer & (ring->size - 1)];
+			printf("         - %s\n              pid: %d, uid: %d, owner: %d, permissions: %u, fsize: %u, inode_no: %lu\n",
+					result->name, result->pid, result->uid, result->owner, result->permissions, result->fsize, result->inode_no);
+			total++;
+		}
+		__atomic_store_n(&ring->consumer, consumer, __ATOMIC_RELEASE);
+
+		if (__atomic_load_n(&ring->done, __ATOMIC_ACQUIRE)
+				&& consumer == __atomic_load_n(&ring->producer,
+					__ATOMIC_ACQUIRE)) {
+			break;
+		}
+		if (ioctl(fd, OFS_RING_FILL) < 0) {
+			fprintf(stderr, "[FAILED] ioctl OFS_RING_FILL: %s\n", strerror(errno));
+			return -1;
+		}
+		refills++;
+	}
+	printf("[  OK  ] %lu results, %lu refills\n", total, refills);
+
+	munmap(map, length);
+	if (close(fd)) {
+		fprintf(stderr, "[FAILED] close: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("[  OK  ] close\n");
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+#define READ_BATCH 256
+
+/*
+ * Searches the open files of a container: the search is restricted to the
+ * pid namespace of a process and/or a cgroup v2 (OFS_SET_SCOPE, "-" = any)
+ * and compared to the same search without a scope.
+ */
+static int search(int fd, struct query *query) {
+	static struct ofs_result results[READ_BATCH];
+	int total = 0;
+	int result_count;
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+	if (ioctl(fd, query->ioctl_cmd, query_arg(query))) {
+		fprintf(stderr, "[FAILED] search: %s\n", strerror(errno));
+		return -1;
+	}
+	while ((result_count = read(fd, results, READ_BATCH)) > 0) {
+		total += result_count;
+	}
+	gettimeofday(&end, NULL);
+	if (result_count < 0) {
+		fprintf(stderr, "[FAILED] read: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("[ INFO ] %d results in %.3f ms\n", total,
+			((end.tv_sec - start.tv_sec) * 1e6
+			 + (end.tv_usec - start.tv_usec)) / 1e3);
+	return total;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 5) {
+		printf("Usage: scope <pid|-> <cgroup|-> <ioctl_cmd|ALL> <ioctl_arg>\n");
+		return -1;
+	}
+
+	struct ofs_scope scope;
+	memset(&scope, 0, sizeof(scope));
+	if (strcmp("-", argv[1]) != 0) {
+		scope.pid = atoi(argv[1]);
+	}
+	if (strcmp("-", argv[2]) != 0) {
+		scope.cgroup = (unsigned long) argv[2];
+	}
+
+	static struct query query;
+	if (parse_query(&query, argv[3], argv[4])) {
+		return -1;
+	}
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+	unsigned int mode = OFS_MODE_STREAM;
+	if (ioctl(fd, OFS_SET_MODE, &mode)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SET_MODE: %s\n", strerror(errno));
+		return -1;
+	}
+
+	printf("[ INFO ] without scope:\n");
+	if (search(fd, &query) < 0) {
+		return -1;
+	}
+
+	if (ioctl(fd, OFS_SET_SCOPE, &scope)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_SET_SCOPE: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("[  OK  ] ioctl OFS_SET_SCOPE\n");
+	printf("[ INFO ] with scope:\n");
+	if (search(fd, &query) < 0) {
+		return -1;
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "../openFileSearch.h"
+
+#define READ_BATCH 32
+
+/*
+ * Runs n concurrent openers of /dev/openFileSearchDev. Each opener holds a
+ * different number of extra open files and repeatedly searches its own pid
+ * (plus a full system scan by uid). Results of other sessions leaking into
+ * a search show up as wrong pids or wrong counts.
+ */
+static int count_results(int fd, pid_t expected_pid, int *foreign) {
+	struct ofs_result results[READ_BATCH];
+	int total = 0;
+	int result_count;
+
+	while ((result_count = read(fd, results, READ_BATCH)) > 0) {
+		for (int i = 0; i < result_count; i++) {
+			if (expected_pid && results[i].pid != expected_pid) {
+				(*foreign)++;
+			}
+		}
+		total += result_count;
+	}
+	return result_count < 0 ? -1 : total;
+}
+
+static int run_opener(int id, int iterations) {
+	int errors = 0;
+	int foreign = 0;
+	int expected = -1;
+	pid_t pid = getpid();
+	unsigned int uid = getuid();
+
+	// every opener holds a different number of files
+	for (int i = 0; i < id; i++) {
+		if (open("/dev/null", O_RDONLY) < 0) {
+			perror("open /dev/null");
+			return 1;
+		}
+	}
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] opener %d: open: %s\n", id,
+				strerror(errno));
+		return 1;
+	}
+
+	for (int i = 0; i < iterations; i++) {
+		if (ioctl(fd, OFS_PID, &pid)) {
+			fprintf(stderr, "[FAILED] opener %d: ioctl OFS_PID: %s\n",
+					id, strerror(errno));
+			errors++;
+			continue;
+		}
+		int count = count_results(fd, pid, &foreign);
+		if (count < 0) {
+			errors++;
+		} else if (expected < 0) {
+			expected = count;
+		} else if (count != expected) {
+			fprintf(stderr, "[FAILED] opener %d: %d results, " \
+					"expected %d\n", id, count, expected);
+			errors++;
+		}
+
+		if (ioctl(fd, OFS_UID, &uid)
+				|| count_results(fd, 0, &foreign) < 0) {
+			fprintf(stderr, "[FAILED] opener %d: OFS_UID: %s\n", id,
+					strerror(errno));
+			errors++;
+		}
+	}
+
+	if (foreign) {
+		fprintf(stderr, "[FAILED] opener %d: %d results of other " \
+				"processes\n", id, foreign);
+	}
+	close(fd);
+	return errors || foreign;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		printf("Usage: stress <openers> <iterations>\n");
+		return -1;
+	}
+
+	int openers = atoi(argv[1]);
+	int iterations = atoi(argv[2]);
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < openers; i++) {
+		pid_t child = fork();
+		if (child < 0) {
+			perror("fork");
+			return -1;
+		} else if (child == 0) {
+			exit(run_opener(i, iterations));
+		}
+	}
+
+	int failed = 0;
+	int status;
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			failed++;
+		}
+	}
+	gettimeofday(&end, NULL);
+
+	double elapsed = (end.tv_sec - start.tv_sec)
+		+ (end.tv_usec - start.tv_usec) / 1e6;
+	printf("[ INFO ] %d openers x %d iterations in %.3f s\n", openers,
+			iterations, elapsed);
+	if (failed) {
+		printf("[FAILED] %d/%d openers\n", failed, openers);
+		return 1;
+	}
+	printf("[  OK  ] stress\n");
+	return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "query.h"
+
+/*
+ * Prints the k largest open files or the k processes with the most open
+ * files matching a search command (OFS_TOP).
+ */
+int main(int argc, char **argv) {
+	if (argc < 5) {
+		printf("Usage: top <size|fds> <k> <ioctl_cmd|ALL> <ioctl_arg>\n");
+		return -1;
+	}
+
+	struct ofs_top top;
+	memset(&top, 0, sizeof(top));
+	if (strcmp("size", argv[1]) == 0) {
+		top.rank_by = OFS_RANK_SIZE;
+	} else if (strcmp("fds", argv[1]) == 0) {
+		top.rank_by = OFS_RANK_FDS;
+	} else {
+		fprintf(stderr, "Unknown rank %s\n", argv[1]);
+		return -1;
+	}
+	top.k = atoi(argv[2]);
+
+	static struct query query;
+	if (parse_query(&query, argv[3], argv[4])) {
+		return -1;
+	}
+	top.ioctl_cmd = query.ioctl_cmd;
+	top.ioctl_arg = (unsigned long) query_arg(&query);
+
+	struct ofs_ranked *results = calloc(top.k, sizeof(*results));
+	if (!results) {
+		perror("calloc");
+		return -1;
+	}
+	top.results = (unsigned long) results;
+
+	int fd = open("/dev/openFileSearchDev", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[FAILED] open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(fd, OFS_TOP, &top)) {
+		fprintf(stderr, "[FAILED] ioctl OFS_TOP: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("[  OK  ] ioctl OFS_TOP\n");
+
+	for (unsigned int i = 0; i < top.count; i++) {
+		struct ofs_result *result = &results[i].result;
+		if (top.rank_by == OFS_RANK_SIZE) {
+			printf("         %2u. %llu bytes: %s\n              pid: %d, uid: %d, inode_no: %lu\n",
+					i + 1, results[i].rank, result->name, result->pid,
+					result->uid, result->inode_no);
+		} else {
+			printf("         %2u. %llu open files: %s (pid: %d, uid: %d)\n",
+					i + 1, results[i].rank, result->name, result->pid,
+					result->uid);
+		}
+	}
+	printf("[ INFO ] top %u of %llu matching open files\n", top.count,
+			top.matches);
+
+	close(fd);
+	free(results);
+	return 0;
+}
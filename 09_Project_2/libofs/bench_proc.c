@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include "libofs.h"
+
+/*
+ * Compares the /proc backend with the kernel module on the same synthetic
+ * workload: processes children each hold files open files of a temporary
+ * directory. Every query (OFS_PID of one child, OFS_UID and OFS_OWNER of the
+ * caller, OFS_NAME of one of the files, all open files) is performed
+ * iterations times by both backends; the mean time and the number of
+ * results are printed.
+ */
+static double now_ms(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+/*
+ * Performs a query iterations times. Returns the mean time in ms (or -1)
+ * and the number of results of the last iteration.
+ */
+static double run(struct libofs *ofs, const struct libofs_query *query,
+		int iterations, long *count) {
+	static struct ofs_result results[LIBOFS_MAX_BATCH];
+	double start = now_ms();
+	ssize_t n;
+
+	for (int i = 0; i < iterations; i++) {
+		if (libofs_search(ofs, query)) {
+			return -1;
+		}
+		*count = 0;
+		while ((n = libofs_read(ofs, results, LIBOFS_MAX_BATCH)) > 0) {
+			*count += n;
+		}
+		if (n < 0) {
+			return -1;
+		}
+	}
+	return (now_ms() - start) / iterations;
+}
+
+static void holder(const char *dir, int files) {
+	char path[PATH_MAX];
+
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/%d", dir, i);
+		if (open(path, O_RDONLY) < 0) {
+			perror("open");
+			exit(1);
+		}
+	}
+	pause();
+	exit(0);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 4) {
+		printf("Usage: bench_proc <processes> <files> <iterations> [threads]\n");
+		return -1;
+	}
+	int processes = atoi(argv[1]);
+	int files = atoi(argv[2]);
+	int iterations = atoi(argv[3]);
+	unsigned int threads = argc > 4 ? atoi(argv[4]) : 0;
+
+	// short paths: OFS_NAME compares at most OFS_RESULT_NAME_MAX_LENGTH bytes
+	char dir[] = "/tmp/ofsXXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return -1;
+	}
+	char path[PATH_MAX];
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/%d", dir, i);
+		int fd = open(path, O_WRONLY | O_CREAT, 0600);
+		if (fd < 0) {
+			perror("open");
+			return -1;
+		}
+		close(fd);
+	}
+
+	pid_t *children = calloc(processes, sizeof(pid_t));
+	for (int i = 0; i < processes; i++) {
+		if ((children[i] = fork()) < 0) {
+			perror("fork");
+			processes = i;
+			break;
+		} else if (children[i] == 0) {
+			holder(dir, files);
+		}
+	}
+	// give the holders time to open their files
+	usleep(100000 + processes * 1000);
+
+	snprintf(path, sizeof(path), "%s/0", dir);
+	struct libofs_query queries[] = {
+		libofs_query_pid(processes ? children[0] : getpid()),
+		libofs_query_uid(getuid()),
+		libofs_query_owner(getuid()),
+		libofs_query_name(path),
+		libofs_query_all(),
+	};
+	const char *names[] = { "pid", "uid", "owner", "name", "all" };
+
+	struct libofs kernel;
+	struct libofs proc;
+	int have_kernel = libofs_open(&kernel, OFS_MODE_STREAM) == 0;
+	if (!have_kernel) {
+		fprintf(stderr, "[ INFO ] kernel module not available: %s\n",
+				strerror(errno));
+	}
+	if (libofs_open_proc(&proc, threads)) {
+		perror("open /proc");
+		return -1;
+	}
+
+	printf("[ INFO ] %d processes x %d files, %d iterations, %u threads\n",
+			processes, files, iterations, proc.threads);
+	printf("%-6s %12s %10s %12s %10s %8s\n", "query", "kernel [ms]",
+			"results", "proc [ms]", "results", "speedup");
+	for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+		long kernel_count = 0;
+		long proc_count = 0;
+		double kernel_ms = have_kernel
+			? run(&kernel, &queries[i], iterations, &kernel_count) : -1;
+		double proc_ms = run(&proc, &queries[i], iterations, &proc_count);
+
+		printf("%-6s ", names[i]);
+		if (kernel_ms >= 0) {
+			printf("%12.3f %10ld ", kernel_ms, kernel_count);
+		} else {
+			printf("%12s %10s ", "n/a", "");
+		}
+		if (proc_ms >= 0) {
+			printf("%12.3f %10ld ", proc_ms, proc_count);
+		} else {
+			printf("%12s %10s ", "n/a", "");
+		}
+		if (kernel_ms > 0 && proc_ms >= 0) {
+			printf("%7.1fx", proc_ms / kernel_ms);
+		}
+		putchar('\n');
+	}
+
+	if (have_kernel) {
+		libofs_close(&kernel);
+	}
+	libofs_close(&proc);
+	for (int i = 0; i < processes; i++) {
+		kill(children[i], SIGTERM);
+	}
+	while (wait(NULL) > 0) {
+	}
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/%d", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+	free(children);
+	return 0;
+}
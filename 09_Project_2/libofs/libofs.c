@@ -0,0 +1,330 @@
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "libofs.h"
+#include "proc.h"
+
+struct libofs_query libofs_query_pid(pid_t pid) {
+	struct libofs_query query = { .type = LIBOFS_QUERY_PID, .pid = pid };
+	return query;
+}
+
+struct libofs_query libofs_query_uid(uid_t uid) {
+	struct libofs_query query = { .type = LIBOFS_QUERY_UID, .uid = uid };
+	return query;
+}
+
+struct libofs_query libofs_query_owner(uid_t owner) {
+	struct libofs_query query = { .type = LIBOFS_QUERY_OWNER, .uid = owner };
+	return query;
+}
+
+struct libofs_query libofs_query_name(const char *name) {
+	struct libofs_query query = { .type = LIBOFS_QUERY_NAME, .path = name };
+	return query;
+}
+
+struct libofs_query libofs_query_inode(const char *path) {
+	struct libofs_query query = { .type = LIBOFS_QUERY_INODE, .path = path };
+	return query;
+}
+
+struct libofs_query libofs_query_subtree(const char *dirname) {
+	struct libofs_query query = {
+		.type = LIBOFS_QUERY_SUBTREE,
+		.path = dirname,
+	};
+	return query;
+}
+
+struct libofs_query libofs_query_program(const struct ofs_program *program) {
+	struct libofs_query query = {
+		.type = LIBOFS_QUERY_PROGRAM,
+		.program = program,
+	};
+	return query;
+}
+
+struct libofs_query libofs_query_all(void) {
+	struct libofs_query query = { .type = LIBOFS_QUERY_ALL };
+	return query;
+}
+
+static int parse_id(const char *arg, unsigned int *id) {
+	char *end;
+	unsigned long value;
+
+	if (!arg || !*arg) {
+		return -1;
+	}
+	errno = 0;
+	value = strtoul(arg, &end, 10);
+	if (errno || *end || value > UINT_MAX) {
+		return -1;
+	}
+	*id = value;
+	return 0;
+}
+
+int libofs_parse_query(struct libofs_query *query, const char *cmd,
+		const char *arg) {
+	unsigned int id;
+
+	if (strncasecmp(cmd, "OFS_", 4) == 0) {
+		cmd += 4;
+	}
+	memset(query, 0, sizeof(*query));
+	if (strcasecmp(cmd, "all") == 0) {
+		*query = libofs_query_all();
+		return 0;
+	}
+	if (strcasecmp(cmd, "name") == 0 || strcasecmp(cmd, "inode") == 0
+			|| strcasecmp(cmd, "subtree") == 0) {
+		if (!arg) {
+			errno = EINVAL;
+			return -1;
+		}
+		query->type = strcasecmp(cmd, "name") == 0 ? LIBOFS_QUERY_NAME
+			: strcasecmp(cmd, "inode") == 0 ? LIBOFS_QUERY_INODE
+			: LIBOFS_QUERY_SUBTREE;
+		query->path = arg;
+		return 0;
+	}
+	if (parse_id(arg, &id)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (strcasecmp(cmd, "pid") == 0) {
+		*query = libofs_query_pid(id);
+	} else if (strcasecmp(cmd, "uid") == 0) {
+		*query = libofs_query_uid(id);
+	} else if (strcasecmp(cmd, "owner") == 0) {
+		*query = libofs_query_owner(id);
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int libofs_open(struct libofs *ofs, unsigned int mode) {
+	memset(ofs, 0, sizeof(*ofs));
+	if ((ofs->fd = open(LIBOFS_DEVICE, O_RDONLY | O_CLOEXEC)) < 0) {
+		return -1;
+	}
+	if (mode && libofs_set_mode(ofs, mode)) {
+		int err = errno;
+		close(ofs->fd);
+		ofs->fd = -1;
+		errno = err;
+		return -1;
+	}
+	ofs->done = 1;
+	return 0;
+}
+
+int libofs_open_proc(struct libofs *ofs, unsigned int threads) {
+	memset(ofs, 0, sizeof(*ofs));
+	ofs->backend = LIBOFS_BACKEND_PROC;
+	if ((ofs->fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		return -1;
+	}
+	ofs->threads = threads ? threads : LIBOFS_PROC_THREADS;
+	ofs->done = 1;
+	return 0;
+}
+
+void libofs_close(struct libofs *ofs) {
+	if (ofs->fd >= 0) {
+		close(ofs->fd);
+	}
+	free(ofs->results);
+	memset(ofs, 0, sizeof(*ofs));
+	ofs->fd = -1;
+}
+
+int libofs_set_mode(struct libofs *ofs, unsigned int mode) {
+	// results of these modes are not read as struct ofs_result
+	if (mode & (OFS_MODE_RING | OFS_MODE_V2)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (ofs->backend == LIBOFS_BACKEND_KERNEL
+			&& ioctl(ofs->fd, OFS_SET_MODE, &mode)) {
+		return -1;
+	}
+	ofs->mode = mode;
+	ofs->count = ofs->position = 0;
+	ofs->done = 1;
+	return 0;
+}
+
+int libofs_search(struct libofs *ofs, const struct libofs_query *query) {
+	// (open flags & 0) == 0 is true for every open file
+	static const struct ofs_program all = {
+		.length = 1,
+		.insns = { { .op = OFS_OP_FLAGS } },
+	};
+	unsigned int id;
+	int cmd;
+	const void *arg;
+
+	// the kernel only accepts names that fit into a result (with '\0')
+	if (query->type == LIBOFS_QUERY_NAME && strnlen(query->path,
+				OFS_RESULT_NAME_MAX_LENGTH)
+			== OFS_RESULT_NAME_MAX_LENGTH) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (ofs->backend == LIBOFS_BACKEND_PROC) {
+		return libofs_proc_search(ofs, query);
+	}
+
+	switch (query->type) {
+		case LIBOFS_QUERY_PID:
+		case LIBOFS_QUERY_UID:
+		case LIBOFS_QUERY_OWNER:
+			cmd = query->type == LIBOFS_QUERY_PID ? OFS_PID
+				: query->type == LIBOFS_QUERY_UID ? OFS_UID
+				: OFS_OWNER;
+			id = query->type == LIBOFS_QUERY_PID ? (unsigned int)
+				query->pid : query->uid;
+			arg = &id;
+			break;
+		case LIBOFS_QUERY_NAME:
+			// the kernel copies OFS_RESULT_NAME_MAX_LENGTH bytes
+			cmd = OFS_NAME;
+			memset(ofs->name, 0, sizeof(ofs->name));
+			strcpy(ofs->name, query->path);
+			arg = ofs->name;
+			break;
+		case LIBOFS_QUERY_INODE:
+			cmd = OFS_INODE;
+			arg = query->path;
+			break;
+		case LIBOFS_QUERY_SUBTREE:
+			cmd = OFS_SUBTREE;
+			arg = query->path;
+			break;
+		case LIBOFS_QUERY_PROGRAM:
+			cmd = OFS_PROGRAM;
+			arg = query->program;
+			break;
+		case LIBOFS_QUERY_ALL:
+			cmd = OFS_PROGRAM;
+			arg = &all;
+			break;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+
+	ofs->count = ofs->position = 0;
+	ofs->done = 1;
+	if (ioctl(ofs->fd, cmd, arg)) {
+		return -1;
+	}
+	ofs->done = 0;
+	ofs->batch = LIBOFS_MIN_BATCH;
+	return 0;
+}
+
+/*
+ * Returns whether a read() returning n of count results ends the search.
+ * Except in asynchronous mode the kernel only returns fewer results than
+ * requested after the last result, which saves the final empty read().
+ */
+static inline int is_last(struct libofs *ofs, size_t n, size_t count) {
+	return !n || (n < count && !(ofs->mode & OFS_MODE_ASYNC));
+}
+
+/*
+ * Reads the next batch of results into the session's buffer. A full batch
+ * doubles the next one (up to LIBOFS_MAX_BATCH).
+ */
+static ssize_t fill(struct libofs *ofs) {
+	struct ofs_result *results;
+	ssize_t n;
+
+	if (ofs->capacity < ofs->batch) {
+		if (!(results = realloc(ofs->results,
+						ofs->batch * sizeof(*results)))) {
+			// keep going with the smaller buffer
+			ofs->batch = ofs->capacity;
+			if (!ofs->capacity) {
+				return -1;
+			}
+		} else {
+			ofs->results = results;
+			ofs->capacity = ofs->batch;
+		}
+	}
+
+	ofs->count = ofs->position = 0;
+	if ((n = read(ofs->fd, ofs->results, ofs->batch)) < 0) {
+		ofs->done = 1;
+		return -1;
+	}
+	ofs->count = n;
+	if (is_last(ofs, n, ofs->batch)) {
+		ofs->done = 1;
+	} else if ((size_t) n == ofs->batch && ofs->batch < LIBOFS_MAX_BATCH) {
+		ofs->batch *= 2;
+	}
+	return n;
+}
+
+const struct ofs_result *libofs_next(struct libofs *ofs) {
+	while (ofs->position == ofs->count) {
+		if (ofs->done) {
+			errno = 0;
+			return NULL;
+		}
+		if (fill(ofs) < 0) {
+			return NULL;
+		}
+	}
+	return &ofs->results[ofs->position++];
+}
+
+ssize_t libofs_read(struct libofs *ofs, struct ofs_result *results,
+		size_t count) {
+	size_t buffered = ofs->count - ofs->position;
+	ssize_t n;
+
+	if (buffered) {
+		if (buffered > count) {
+			buffered = count;
+		}
+		memcpy(results, &ofs->results[ofs->position],
+				buffered * sizeof(*results));
+		ofs->position += buffered;
+		return buffered;
+	}
+	if (ofs->done || !count) {
+		return 0;
+	}
+
+	// read directly into the caller's buffer
+	if ((n = read(ofs->fd, results, count)) < 0) {
+		ofs->done = 1;
+		return -1;
+	}
+	if (is_last(ofs, n, count)) {
+		ofs->done = 1;
+	}
+	return n;
+}
+
+int libofs_stats(struct libofs *ofs, struct ofs_stats *stats) {
+	if (ofs->backend == LIBOFS_BACKEND_PROC) {
+		*stats = ofs->proc_stats;
+		return 0;
+	}
+	return ioctl(ofs->fd, OFS_STATS, stats);
+}
@@ -0,0 +1,193 @@
+#ifndef LIBOFS_H
+#define LIBOFS_H
+
+#include <sys/types.h>
+#include <limits.h>
+#include "../openFileSearch.h"
+
+/**
+ * The number of results requested by the first read() of a search.
+ */
+#define LIBOFS_MIN_BATCH OFS_MAX_RESULTS
+
+/**
+ * The maximum number of results requested by a single read(). The batch is
+ * doubled whenever a read() fills it completely.
+ */
+#define LIBOFS_MAX_BATCH 16384
+
+/**
+ * The kinds of queries (search commands).
+ */
+enum libofs_query_type {
+	LIBOFS_QUERY_PID,
+	LIBOFS_QUERY_UID,
+	LIBOFS_QUERY_OWNER,
+	LIBOFS_QUERY_NAME,
+	LIBOFS_QUERY_INODE,
+	LIBOFS_QUERY_SUBTREE,
+	LIBOFS_QUERY_PROGRAM,
+	LIBOFS_QUERY_ALL, // every open file
+};
+
+/**
+ * A query. Use the libofs_query_*() constructors.
+ */
+struct libofs_query {
+	enum libofs_query_type type;
+
+	union {
+		/* LIBOFS_QUERY_PID */
+		pid_t pid;
+
+		/* LIBOFS_QUERY_UID and LIBOFS_QUERY_OWNER */
+		uid_t uid;
+
+		/* LIBOFS_QUERY_NAME, LIBOFS_QUERY_INODE and
+		 * LIBOFS_QUERY_SUBTREE (not copied) */
+		const char *path;
+
+		/* LIBOFS_QUERY_PROGRAM (not copied) */
+		const struct ofs_program *program;
+	};
+};
+
+struct libofs_query libofs_query_pid(pid_t pid);
+struct libofs_query libofs_query_uid(uid_t uid);
+struct libofs_query libofs_query_owner(uid_t owner);
+struct libofs_query libofs_query_name(const char *name);
+struct libofs_query libofs_query_inode(const char *path);
+struct libofs_query libofs_query_subtree(const char *dirname);
+struct libofs_query libofs_query_program(const struct ofs_program *program);
+struct libofs_query libofs_query_all(void);
+
+/**
+ * Parses a query from a command name (pid, uid, owner, name, inode,
+ * subtree or all, case-insensitive, with or without "OFS_" prefix) and its
+ * argument. The argument is not copied. Returns 0 or -1 (errno EINVAL).
+ */
+int libofs_parse_query(struct libofs_query *query, const char *cmd,
+		const char *arg);
+
+/**
+ * The backends answering the queries of a session.
+ */
+#define LIBOFS_BACKEND_KERNEL	0 // the kernel module
+#define LIBOFS_BACKEND_PROC	1 // /proc/<pid>/fd walked in user space
+
+/**
+ * The default number of threads of the /proc backend.
+ */
+#define LIBOFS_PROC_THREADS 4
+
+/**
+ * A session with the kernel module (one open() of the device) or with the
+ * /proc backend.
+ *
+ * Not thread-safe: use one session per thread.
+ */
+struct libofs {
+	/* LIBOFS_BACKEND_KERNEL or LIBOFS_BACKEND_PROC */
+	int backend;
+
+	/* The file descriptor of /dev/openFileSearchDev (kernel) or of /proc */
+	int fd;
+
+	/* The number of threads scanning /proc (/proc backend) */
+	unsigned int threads;
+
+	/* The statistics of the last search (/proc backend) */
+	struct ofs_stats proc_stats;
+
+	/* The mode of the session (OFS_MODE_*) */
+	unsigned int mode;
+
+	/* The buffer results are read into (capacity results) */
+	struct ofs_result *results;
+	size_t capacity;
+
+	/* The number of results requested by the next read() */
+	size_t batch;
+
+	/* The results in the buffer and the position of the iterator */
+	size_t count;
+	size_t position;
+
+	/* Whether the kernel has returned all results of the search */
+	int done;
+
+	/* The name argument of OFS_NAME (the kernel copies a fixed size) */
+	char name[OFS_RESULT_NAME_MAX_LENGTH];
+};
+
+/**
+ * The device file of the kernel module.
+ */
+#define LIBOFS_DEVICE "/dev/openFileSearchDev"
+
+/**
+ * Opens a session in the given mode (OFS_MODE_*). Streaming mode
+ * (OFS_MODE_STREAM) is recommended: the number of results is not limited
+ * and large reads are served without rescanning. OFS_MODE_RING and
+ * OFS_MODE_V2 are not supported (EINVAL).
+ *
+ * Returns 0 or -1 (errno set).
+ */
+int libofs_open(struct libofs *ofs, unsigned int mode);
+
+/**
+ * Opens a session answered from /proc instead of the kernel module: the
+ * fd directories of all processes are walked by threads threads (0 =
+ * LIBOFS_PROC_THREADS). The results are the same struct ofs_result records
+ * as far as /proc can tell (see README); only processes the caller may
+ * inspect are searched (all of them as root).
+ *
+ * Supports LIBOFS_QUERY_PID, UID, OWNER, NAME, INODE and ALL (others:
+ * EOPNOTSUPP). Modes are accepted and ignored. The whole scan is performed
+ * by libofs_search().
+ *
+ * Returns 0 or -1 (errno set).
+ */
+int libofs_open_proc(struct libofs *ofs, unsigned int threads);
+
+/**
+ * Closes a session and frees its buffer.
+ */
+void libofs_close(struct libofs *ofs);
+
+/**
+ * Changes the mode of a session (discards the current search).
+ * Returns 0 or -1 (errno set).
+ */
+int libofs_set_mode(struct libofs *ofs, unsigned int mode);
+
+/**
+ * Starts a search. The results are returned by libofs_next() or
+ * libofs_read(). Returns 0 or -1 (errno set by the ioctl, e.g. EINVAL for
+ * a pid that does not exist, or ENAMETOOLONG for a name of
+ * OFS_RESULT_NAME_MAX_LENGTH or more characters).
+ */
+int libofs_search(struct libofs *ofs, const struct libofs_query *query);
+
+/**
+ * Iterator: returns the next result of the current search or NULL after
+ * the last one (errno 0) or on error (errno set). The result is valid until
+ * the next call.
+ */
+const struct ofs_result *libofs_next(struct libofs *ofs);
+
+/**
+ * Returns up to count results of the current search. Results buffered by
+ * libofs_next() are returned first. Returns the number of results (0 after
+ * the last one) or -1 (errno set).
+ */
+ssize_t libofs_read(struct libofs *ofs, struct ofs_result *results,
+		size_t count);
+
+/**
+ * Gets the statistics of the current (or last) search.
+ * Returns 0 or -1 (errno set).
+ */
+int libofs_stats(struct libofs *ofs, struct ofs_stats *stats);
+
+#endif
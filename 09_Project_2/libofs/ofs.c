@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "libofs.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/*
+ * Command line client of the kernel module: performs a single search and
+ * writes all results to stdout as text, JSON lines or raw struct ofs_result
+ * records (binary).
+ */
+enum format { TEXT, JSON, BINARY };
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ofs [-p[threads]] [-m mode[,mode ...]] [-f text|json|binary] [-s] <pid|uid|owner|name|inode|subtree|all> [arg]\n" \
+			"  -p  search /proc instead of using the kernel module (-pN: N threads, default " \
+			"%d)\n" \
+			"  -m  modes: stream (default), parallel, lowlat, async, index, dedup, default\n" \
+			"  -f  output format (default text)\n" \
+			"  -s  print the statistics of the search to stderr\n",
+			LIBOFS_PROC_THREADS);
+}
+
+static int parse_modes(char *modes, unsigned int *mode) {
+	static const struct {
+		const char *name;
+		unsigned int flag;
+	} names[] = {
+		{ "default", 0 },
+		{ "stream", OFS_MODE_STREAM },
+		{ "parallel", OFS_MODE_PARALLEL },
+		{ "lowlat", OFS_MODE_LOWLAT },
+		{ "async", OFS_MODE_ASYNC },
+		{ "index", OFS_MODE_INDEX },
+		{ "dedup", OFS_MODE_DEDUP },
+	};
+	char *name;
+	size_t i;
+
+	*mode = 0;
+	for (name = strtok(modes, ","); name; name = strtok(NULL, ",")) {
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+			if (strcmp(names[i].name, name) == 0) {
+				*mode |= names[i].flag;
+				break;
+			}
+		}
+		if (i == sizeof(names) / sizeof(names[0])) {
+			fprintf(stderr, "Unknown mode %s\n", name);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void print_json_string(const char *string) {
+	putchar('"');
+	for (; *string; string++) {
+		unsigned char c = *string;
+		if (c == '"' || c == '\\') {
+			putchar('\\');
+			putchar(c);
+		} else if (c < 0x20) {
+			printf("\\u%04x", c);
+		} else {
+			putchar(c);
+		}
+	}
+	putchar('"');
+}
+
+static void print_result(const struct ofs_result *result, enum format format) {
+	if (format == TEXT) {
+		printf("%s\tpid: %d, uid: %u, owner: %u, permissions: %o, fsize: %u, inode_no: %lu\n",
+				result->name, result->pid, result->uid, result->owner,
+				result->permissions, result->fsize, result->inode_no);
+		return;
+	}
+	printf("{\"pid\":%d,\"uid\":%u,\"owner\":%u,\"permissions\":%u,\"fsize\":%u,\"inode_no\":%lu,\"name\":",
+			result->pid, result->uid, result->owner, result->permissions,
+			result->fsize, result->inode_no);
+	print_json_string(result->name);
+	fputs("}\n", stdout);
+}
+
+/*
+ * Binary output: results are read directly into a large buffer and written
+ * unchanged (no per-result formatting).
+ */
+static long write_binary(struct libofs *ofs) {
+	static struct ofs_result results[LIBOFS_MAX_BATCH];
+	long total = 0;
+	ssize_t n;
+
+	while ((n = libofs_read(ofs, results, LIBOFS_MAX_BATCH)) > 0) {
+		if (fwrite(results, sizeof(results[0]), n, stdout) != (size_t) n) {
+			return -1;
+		}
+		total += n;
+	}
+	return n < 0 ? -1 : total;
+}
+
+int main(int argc, char **argv) {
+	unsigned int mode = OFS_MODE_STREAM;
+	enum format format = TEXT;
+	int print_stats = 0;
+	int proc = 0;
+	unsigned int threads = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p::m:f:s")) != -1) {
+		switch (opt) {
+			case 'p':
+				proc = 1;
+				threads = optarg ? atoi(optarg) : 0;
+				break;
+			case 'm':
+				if (parse_modes(optarg, &mode)) {
+					return 2;
+				}
+				break;
+			case 'f':
+				if (strcmp("text", optarg) == 0) {
+					format = TEXT;
+				} else if (strcmp("json", optarg) == 0) {
+					format = JSON;
+				} else if (strcmp("binary", optarg) == 0) {
+					format = BINARY;
+				} else {
+					fprintf(stderr, "Unknown format %s\n", optarg);
+					return 2;
+				}
+				break;
+			case 's':
+				print_stats = 1;
+				break;
+			default:
+				usage();
+				return 2;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return 2;
+	}
+
+	struct libofs_query query;
+	if (libofs_parse_query(&query, argv[optind],
+				optind + 1 < argc ? argv[optind + 1] : NULL)) {
+		fprintf(stderr, "Invalid query %s\n", argv[optind]);
+		usage();
+		return 2;
+	}
+
+	struct libofs ofs;
+	if (proc ? libofs_open_proc(&ofs, threads) : libofs_open(&ofs, mode)) {
+		fprintf(stderr, "ofs: open %s: %s\n", proc ? "/proc" : LIBOFS_DEVICE,
+				strerror(errno));
+		return 1;
+	}
+	if (libofs_search(&ofs, &query)) {
+		fprintf(stderr, "ofs: search: %s\n", strerror(errno));
+		libofs_close(&ofs);
+		return 1;
+	}
+
+	setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+	long total = 0;
+	if (format == BINARY) {
+		total = write_binary(&ofs);
+	} else {
+		const struct ofs_result *result;
+		while ((result = libofs_next(&ofs))) {
+			print_result(result, format);
+			total++;
+		}
+		if (errno) {
+			total = -1;
+		}
+	}
+	if (total < 0) {
+		fprintf(stderr, "ofs: read: %s\n", strerror(errno));
+		libofs_close(&ofs);
+		return 1;
+	}
+	fflush(stdout);
+
+	struct ofs_stats stats;
+	if (print_stats && libofs_stats(&ofs, &stats) == 0) {
+		fprintf(stderr, "%ld results, %llu tasks, %llu fds, %llu d_path calls, %llu rejected, %llu truncated names, scan %llu ns, max lock hold %llu ns\n",
+				total, stats.tasks, stats.fds, stats.d_path_calls,
+				stats.rejected, stats.truncated_names, stats.scan_ns,
+				stats.max_lock_ns);
+	}
+	libofs_close(&ofs);
+	return 0;
+}
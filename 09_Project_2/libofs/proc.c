@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "proc.h"
+
+/*
+ * The /proc backend: the fd directories of all processes (/proc/<pid>/fd)
+ * are walked by a pool of threads taking one pid at a time. Every lookup is
+ * relative to a directory fd (openat(), readlinkat(), fstatat()) and
+ * directories are read in large batches via getdents64, so no path is
+ * resolved from / and no readdir() buffer of 32 KB limits the batches.
+ */
+
+#define DIRENT_BUFFER_SIZE (64 * 1024)
+
+struct linux_dirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/*
+ * A search of the /proc backend shared by all workers.
+ */
+struct proc_scan {
+	const struct libofs_query *query;
+
+	/* The fd of /proc */
+	int proc_fd;
+
+	/* The pids to be searched */
+	pid_t *pids;
+	size_t pid_count;
+
+	/* The index of the next pid to be searched by any worker */
+	size_t next_pid;
+
+	/* The file of LIBOFS_QUERY_INODE */
+	dev_t dev;
+	ino_t ino;
+};
+
+/*
+ * A worker of a search. Every worker has its own results and statistics.
+ */
+struct proc_worker {
+	pthread_t thread;
+	struct proc_scan *scan;
+	struct ofs_result *results;
+	size_t count;
+	size_t capacity;
+	struct ofs_stats stats;
+	char dirents[DIRENT_BUFFER_SIZE];
+};
+
+static inline long getdents64(int fd, char *buffer, size_t size) {
+	return syscall(SYS_getdents64, fd, buffer, size);
+}
+
+static int is_pid(const char *name) {
+	if (!*name) {
+		return 0;
+	}
+	for (; *name; name++) {
+		if (*name < '0' || *name > '9') {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Lists the pids of all processes (the numeric entries of /proc).
+ */
+static int list_pids(struct proc_scan *scan, char *buffer) {
+	size_t capacity = 1024;
+	long n;
+	long i;
+	pid_t *pids;
+
+	if (!(scan->pids = malloc(capacity * sizeof(pid_t)))) {
+		return -1;
+	}
+	scan->pid_count = 0;
+	if (lseek(scan->proc_fd, 0, SEEK_SET) < 0) {
+		return -1;
+	}
+	while ((n = getdents64(scan->proc_fd, buffer, DIRENT_BUFFER_SIZE)) > 0) {
+		for (i = 0; i < n; ) {
+			struct linux_dirent64 *entry =
+				(struct linux_dirent64 *) (buffer + i);
+			i += entry->d_reclen;
+			if (!is_pid(entry->d_name)) {
+				continue;
+			}
+			if (scan->pid_count == capacity) {
+				capacity *= 2;
+				if (!(pids = realloc(scan->pids,
+								capacity * sizeof(pid_t)))) {
+					return -1;
+				}
+				scan->pids = pids;
+			}
+			scan->pids[scan->pid_count++] = atoi(entry->d_name);
+		}
+	}
+	return n < 0 ? -1 : 0;
+}
+
+/*
+ * Reads the real uid of a process (like cred->uid) from its status file.
+ */
+static int read_uid(int pid_fd, uid_t *uid) {
+	char status[4096];
+	ssize_t n;
+	char *line;
+	int fd;
+
+	if ((fd = openat(pid_fd, "status", O_RDONLY | O_CLOEXEC)) < 0) {
+		return -1;
+	}
+	n = read(fd, status, sizeof(status) - 1);
+	close(fd);
+	if (n <= 0) {
+		return -1;
+	}
+	status[n] = '\0';
+	if (!(line = strstr(status, "\nUid:"))) {
+		return -1;
+	}
+	*uid = strtoul(line + 5, NULL, 10);
+	return 0;
+}
+
+static struct ofs_result *add_result(struct proc_worker *worker) {
+	struct ofs_result *results;
+	size_t capacity;
+
+	if (worker->count == worker->capacity) {
+		// the worker is left unchanged if no memory is available
+		capacity = worker->capacity ? 2 * worker->capacity : 256;
+		if (!(results = realloc(worker->results,
+						capacity * sizeof(*results)))) {
+			return NULL;
+		}
+		worker->results = results;
+		worker->capacity = capacity;
+	}
+	return &worker->results[worker->count];
+}
+
+/*
+ * Builds the name of a result like d_path() into a buffer of
+ * OFS_RESULT_NAME_MAX_LENGTH bytes: a path that does not fit is replaced by
+ * its last component (the kernel uses the short name of the dentry).
+ */
+static int name_to_result(struct ofs_result *result, int fd_dir,
+		const char *fd_name, struct ofs_stats *stats) {
+	char link[PATH_MAX];
+	const char *short_name;
+	ssize_t length;
+
+	if ((length = readlinkat(fd_dir, fd_name, link, sizeof(link) - 1)) < 0) {
+		return -1;
+	}
+	link[length] = '\0';
+	stats->d_path_calls++;
+	if (length < OFS_RESULT_NAME_MAX_LENGTH) {
+		memcpy(result->name, link, length + 1);
+		return 0;
+	}
+	stats->truncated_names++;
+	short_name = strrchr(link, '/');
+	short_name = short_name ? short_name + 1 : link;
+	strncpy(result->name, short_name, OFS_RESULT_NAME_MAX_LENGTH - 1);
+	result->name[OFS_RESULT_NAME_MAX_LENGTH - 1] = '\0';
+	return 0;
+}
+
+static int stat_to_result(struct ofs_result *result, int fd_dir,
+		const char *fd_name, struct stat *st) {
+	// follows the magic link to the open file (also sockets and pipes)
+	if (fstatat(fd_dir, fd_name, st, 0)) {
+		return -1;
+	}
+	result->owner = st->st_uid;
+	result->permissions = st->st_mode;
+	result->fsize = st->st_size;
+	result->inode_no = st->st_ino;
+	return 0;
+}
+
+/*
+ * Applies the query to an open fd of a process. Like the kernel only the
+ * fields the filter needs are looked up before the filter is applied.
+ */
+static void search_fd(struct proc_worker *worker, int fd_dir,
+		const char *fd_name, pid_t pid, uid_t uid) {
+	const struct libofs_query *query = worker->scan->query;
+	struct ofs_result *result;
+	struct stat st;
+
+	if (!(result = add_result(worker))) {
+		return;
+	}
+	result->pid = pid;
+	result->uid = uid;
+
+	if (query->type == LIBOFS_QUERY_NAME) {
+		if (name_to_result(result, fd_dir, fd_name, &worker->stats)) {
+			return;
+		}
+		if (strncmp(result->name, query->path,
+					OFS_RESULT_NAME_MAX_LENGTH) != 0) {
+			worker->stats.rejected++;
+			return;
+		}
+		if (stat_to_result(result, fd_dir, fd_name, &st)) {
+			return;
+		}
+	} else {
+		if (stat_to_result(result, fd_dir, fd_name, &st)) {
+			return;
+		}
+		if ((query->type == LIBOFS_QUERY_OWNER && st.st_uid != query->uid)
+				|| (query->type == LIBOFS_QUERY_INODE
+					&& (st.st_dev != worker->scan->dev
+						|| st.st_ino != worker->scan->ino))) {
+			worker->stats.rejected++;
+			return;
+		}
+		if (name_to_result(result, fd_dir, fd_name, &worker->stats)) {
+			return;
+		}
+	}
+	worker->count++;
+}
+
+/*
+ * Searches the open fds of a process. Processes that have exited or may
+ * not be inspected by the caller are skipped.
+ */
+static void search_pid(struct proc_worker *worker, pid_t pid) {
+	const struct libofs_query *query = worker->scan->query;
+	char pid_name[16];
+	int pid_fd;
+	int fd_dir;
+	uid_t uid;
+	long n;
+	long i;
+
+	snprintf(pid_name, sizeof(pid_name), "%d", pid);
+	if ((pid_fd = openat(worker->scan->proc_fd, pid_name,
+					O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		return;
+	}
+	worker->stats.tasks++;
+	if (read_uid(pid_fd, &uid)
+			|| (query->type == LIBOFS_QUERY_UID && uid != query->uid)) {
+		close(pid_fd);
+		return;
+	}
+	fd_dir = openat(pid_fd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	close(pid_fd);
+	if (fd_dir < 0) {
+		return;
+	}
+
+	while ((n = getdents64(fd_dir, worker->dirents,
+					DIRENT_BUFFER_SIZE)) > 0) {
+		for (i = 0; i < n; ) {
+			struct linux_dirent64 *entry =
+				(struct linux_dirent64 *) (worker->dirents + i);
+			i += entry->d_reclen;
+			if (entry->d_name[0] == '.') {
+				continue;
+			}
+			worker->stats.fds++;
+			search_fd(worker, fd_dir, entry->d_name, pid, uid);
+		}
+	}
+	close(fd_dir);
+}
+
+static void *worker_fn(void *arg) {
+	struct proc_worker *worker = arg;
+	struct proc_scan *scan = worker->scan;
+	size_t index;
+
+	while ((index = __atomic_fetch_add(&scan->next_pid, 1,
+					__ATOMIC_RELAXED)) < scan->pid_count) {
+		search_pid(worker, scan->pids[index]);
+	}
+	return NULL;
+}
+
+static unsigned long long now_ns(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int libofs_proc_search(struct libofs *ofs, const struct libofs_query *query) {
+	struct proc_scan scan = { .query = query, .proc_fd = ofs->fd };
+	struct proc_worker *workers;
+	unsigned int worker_count;
+	unsigned int started = 0;
+	unsigned long long started_at = now_ns();
+	struct ofs_result *results;
+	struct stat st;
+	size_t total = 0;
+	unsigned int i;
+	int err = 0;
+
+	ofs->count = ofs->position = 0;
+	ofs->done = 1;
+	memset(&ofs->proc_stats, 0, sizeof(ofs->proc_stats));
+
+	switch (query->type) {
+		case LIBOFS_QUERY_PID:
+		case LIBOFS_QUERY_UID:
+		case LIBOFS_QUERY_OWNER:
+		case LIBOFS_QUERY_NAME:
+		case LIBOFS_QUERY_ALL:
+			break;
+		case LIBOFS_QUERY_INODE:
+			if (stat(query->path, &st)) {
+				return -1;
+			}
+			scan.dev = st.st_dev;
+			scan.ino = st.st_ino;
+			break;
+		default:
+			errno = EOPNOTSUPP;
+			return -1;
+	}
+
+	// a single process is searched by the caller
+	worker_count = query->type == LIBOFS_QUERY_PID ? 1 : ofs->threads;
+	if (!(workers = calloc(worker_count, sizeof(*workers)))) {
+		return -1;
+	}
+	for (i = 0; i < worker_count; i++) {
+		workers[i].scan = &scan;
+	}
+
+	if (query->type == LIBOFS_QUERY_PID) {
+		char pid_name[16];
+		int pid_fd;
+
+		// like OFS_PID: -EINVAL for a pid that does not exist
+		snprintf(pid_name, sizeof(pid_name), "%d", query->pid);
+		if (query->pid <= 0 || (pid_fd = openat(ofs->fd, pid_name,
+						O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+			free(workers);
+			errno = EINVAL;
+			return -1;
+		}
+		close(pid_fd);
+		search_pid(&workers[0], query->pid);
+		started = 1;
+	} else if (list_pids(&scan, workers[0].dirents)) {
+		err = errno;
+	} else {
+		for (started = 1; started < worker_count; started++) {
+			if (pthread_create(&workers[started].thread, NULL,
+						worker_fn, &workers[started])) {
+				break;
+			}
+		}
+		// the caller is the first worker
+		worker_fn(&workers[0]);
+		for (i = 1; i < started; i++) {
+			pthread_join(workers[i].thread, NULL);
+		}
+	}
+	free(scan.pids);
+
+	// merge the results of all workers
+	for (i = 0; i < started; i++) {
+		total += workers[i].count;
+	}
+	if (!err && total > ofs->capacity) {
+		if (!(results = realloc(ofs->results, total * sizeof(*results)))) {
+			err = errno;
+		} else {
+			ofs->results = results;
+			ofs->capacity = total;
+		}
+	}
+	for (i = 0; i < started; i++) {
+		if (!err) {
+			memcpy(&ofs->results[ofs->count], workers[i].results,
+					workers[i].count * sizeof(*results));
+			ofs->count += workers[i].count;
+		}
+		free(workers[i].results);
+		ofs->proc_stats.tasks += workers[i].stats.tasks;
+		ofs->proc_stats.fds += workers[i].stats.fds;
+		ofs->proc_stats.d_path_calls += workers[i].stats.d_path_calls;
+		ofs->proc_stats.rejected += workers[i].stats.rejected;
+		ofs->proc_stats.truncated_names += workers[i].stats.truncated_names;
+	}
+	free(workers);
+	ofs->proc_stats.scan_ns = now_ns() - started_at;
+
+	if (err) {
+		ofs->count = 0;
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
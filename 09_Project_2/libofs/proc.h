@@ -0,0 +1,12 @@
+#ifndef LIBOFS_PROC_H
+#define LIBOFS_PROC_H
+
+#include "libofs.h"
+
+/*
+ * Performs a search of the /proc backend: all results are stored in the
+ * session's buffer. Returns 0 or -1 (errno set).
+ */
+int libofs_proc_search(struct libofs *ofs, const struct libofs_query *query);
+
+#endif
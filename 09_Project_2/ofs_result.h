@@ -32,4 +32,136 @@ struct ofs_result {
 	unsigned long inode_no;
 };
 
+/**
+ * A single result (open file) in the v2 format (OFS_MODE_V2).
+ *
+ * Records have a variable length: the full path follows the fixed fields
+ * and the record is padded to a multiple of 8 bytes. The next record starts
+ * size bytes after the start of this one.
+ */
+struct ofs_record {
+	/* The size of the record in bytes (including path and padding) */
+	unsigned int size;
+
+	/* The length of path (without the terminating null byte) */
+	unsigned int path_length;
+
+	/* The pid of the process holding the opened file */
+	unsigned int pid;
+
+	/* The uid of the owner of the process holding the open file */
+	unsigned int uid;
+
+	/* The uid of the owner of the opened file */
+	unsigned int owner;
+
+	/* The mode of the opened file (type and permissions) */
+	unsigned int mode;
+
+	/* The flags the file has been opened with (O_*) */
+	unsigned int flags;
+
+	/* The device of the file system of the opened file (st_dev) */
+	unsigned int dev;
+
+	/* The size of the opened file in bytes */
+	unsigned long long fsize;
+
+	/* The inode number of the opened file */
+	unsigned long long inode_no;
+
+	/* The file position of the open file */
+	unsigned long long pos;
+
+	/* The number of users of the fd table (tasks sharing it via
+	 * CLONE_FILES, 0 = unknown) */
+	unsigned int table_users;
+
+	/* The number of references to the open file (fds in all fd tables,
+	 * e.g. after dup() or fork(), and references in use) */
+	unsigned int file_refs;
+
+	/* The full path of the opened file (null-terminated) */
+	char path[];
+};
+
+/**
+ * The maximum size of a struct ofs_record (path of PATH_MAX bytes).
+ */
+#define OFS_RECORD_MAX_SIZE (sizeof(struct ofs_record) + 4096)
+
+/**
+ * The typed part of a v2 record of a socket (OFS_MODE_TYPED, mode
+ * S_IFSOCK).
+ */
+struct ofs_socket {
+	/* The address family (AF_*) */
+	unsigned short family;
+
+	/* The socket type (SOCK_*) */
+	unsigned short type;
+
+	/* The protocol (e.g. IPPROTO_TCP) */
+	unsigned short protocol;
+
+	/* The state (TCP_* states, also used by AF_UNIX sockets) */
+	unsigned short state;
+
+	/* The local and remote port (AF_INET, AF_INET6, host byte order) */
+	unsigned short local_port;
+	unsigned short remote_port;
+
+	unsigned int reserved;
+
+	/* The local and remote address (network byte order; AF_INET: the
+	 * first 4 bytes, AF_INET6: all 16 bytes) */
+	unsigned char local_addr[16];
+	unsigned char remote_addr[16];
+
+	/* The inode number of the connected peer socket (AF_UNIX, 0 = not
+	 * connected); the peer's record has this inode_no */
+	unsigned long long peer_inode;
+};
+
+/*
+ * Ends of a pipe (struct ofs_pipe.end).
+ */
+#define OFS_PIPE_READ	0x1
+#define OFS_PIPE_WRITE	0x2
+
+/**
+ * The typed part of a v2 record of an anonymous pipe (OFS_MODE_TYPED, mode
+ * S_IFIFO).
+ *
+ * Both ends of a pipe share its inode: the peers of an end are the records
+ * with the same inode_no holding the other end.
+ */
+struct ofs_pipe {
+	/* The end(s) the open file refers to (OFS_PIPE_*) */
+	unsigned int end;
+
+	/* The number of open files referring to the read and the write end */
+	unsigned int readers;
+	unsigned int writers;
+
+	/* The number of buffers holding unread data */
+	unsigned int buffers;
+};
+
+/**
+ * The offset of the typed part of a v2 record with a path of path_length
+ * bytes.
+ */
+#define OFS_RECORD_TYPED_OFFSET(path_length) \
+	((sizeof(struct ofs_record) + (path_length) + 1 + 7) & ~7UL)
+
+/**
+ * Returns the typed part of a v2 record (struct ofs_socket or struct
+ * ofs_pipe depending on mode) or NULL if the record has none.
+ */
+#define OFS_RECORD_TYPED(record) \
+	((record)->size > OFS_RECORD_TYPED_OFFSET((record)->path_length) \
+	 ? (void *) ((char *) (record) \
+		 + OFS_RECORD_TYPED_OFFSET((record)->path_length)) : NULL)
+
 #endif
@@ -0,0 +1,79 @@
+/*
+ * Tracepoints of openFileSearch (events openFileSearch:ofs_scan_start and
+ * openFileSearch:ofs_scan_end, see /sys/kernel/debug/tracing/events).
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM openFileSearch
+
+#if !defined(_OFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _OFS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include "openFileSearch.h"
+
+/*
+ * A scan of a session starts: the whole scan of a search or a part of a
+ * streaming (ring, asynchronous) search.
+ */
+TRACE_EVENT(ofs_scan_start,
+	TP_PROTO(const void *session, unsigned int mode, unsigned int limit),
+	TP_ARGS(session, mode, limit),
+	TP_STRUCT__entry(
+		__field(const void *, session)
+		__field(unsigned int, mode)
+		__field(unsigned int, limit)
+	),
+	TP_fast_assign(
+		__entry->session = session;
+		__entry->mode = mode;
+		__entry->limit = limit;
+	),
+	TP_printk("session=%p mode=0x%x limit=%u", __entry->session,
+		__entry->mode, __entry->limit)
+);
+
+/*
+ * A scan of a session ends; stats holds the counters of this scan only.
+ */
+TRACE_EVENT(ofs_scan_end,
+	TP_PROTO(const void *session, unsigned int results,
+		const struct ofs_stats *stats),
+	TP_ARGS(session, results, stats),
+	TP_STRUCT__entry(
+		__field(const void *, session)
+		__field(unsigned int, results)
+		__field(unsigned long long, tasks)
+		__field(unsigned long long, fds)
+		__field(unsigned long long, d_path_calls)
+		__field(unsigned long long, rejected)
+		__field(unsigned long long, truncated_names)
+		__field(unsigned long long, scan_ns)
+		__field(unsigned long long, max_lock_ns)
+	),
+	TP_fast_assign(
+		__entry->session = session;
+		__entry->results = results;
+		__entry->tasks = stats->tasks;
+		__entry->fds = stats->fds;
+		__entry->d_path_calls = stats->d_path_calls;
+		__entry->rejected = stats->rejected;
+		__entry->truncated_names = stats->truncated_names;
+		__entry->scan_ns = stats->scan_ns;
+		__entry->max_lock_ns = stats->max_lock_ns;
+	),
+	TP_printk("session=%p results=%u tasks=%llu fds=%llu d_path=%llu " \
+		"rejected=%llu truncated=%llu scan_ns=%llu max_lock_ns=%llu",
+		__entry->session, __entry->results, __entry->tasks,
+		__entry->fds, __entry->d_path_calls, __entry->rejected,
+		__entry->truncated_names, __entry->scan_ns,
+		__entry->max_lock_ns)
+);
+
+#endif /* _OFS_TRACE_H */
+
+// the header is not in include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ofs_trace
+#include <trace/define_trace.h>
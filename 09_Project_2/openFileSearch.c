@@ -8,337 +8,4948 @@
 #include <linux/dcache.h>
 #include <linux/uaccess.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
 #include <linux/err.h>
 #include <linux/init_task.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/namei.h>
+#include <linux/path.h>
+#include <linux/string.h>
+#include <linux/nsproxy.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/kprobes.h>
+#include <linux/hash.h>
+#include <linux/cred.h>
+#include <linux/capability.h>
+#include <linux/kdev_t.h>
+#include <linux/pid_namespace.h>
+#include <linux/cgroup.h>
+#include <linux/kref.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/net.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/magic.h>
+#include <linux/fs_struct.h>
+#include <net/sock.h>
+#include <net/af_unix.h>
 #include "openFileSearch.h"
 
+#define CREATE_TRACE_POINTS
+#include "ofs_trace.h"
+
 #define MODULE_NAME "openFileSearch"
 
 MODULE_AUTHOR("Marcel Binder <binder4@hm.edu>");
 MODULE_LICENSE("GPL");
+MODULE_VERSION("1.1");
+
+/**
+ * The maximum number of workers of a parallel scan.
+ */
+#define OFS_MAX_WORKERS 64
+
+/**
+ * The maximum number of fds visited per lock section in OFS_MODE_LOWLAT.
+ */
+#define OFS_CHUNK_FDS 32
+
+/**
+ * The number of buckets of the tables of the open file index (log2).
+ */
+#define OFS_INDEX_BITS 12
+
+/**
+ * The number of events of the per-CPU rings of a subscription (power of 2).
+ */
+#define OFS_EVENT_RING_SIZE 256
+
+/**
+ * The size of the buffer v2 records are staged in (OFS_MODE_V2).
+ */
+#define OFS_RECORD_BUFFER_SIZE (64 * 1024)
+
+/**
+ * The number of slots of the set of open files of a fd table seen by a
+ * scan (OFS_MODE_DEDUP, log2).
+ */
+#define OFS_SEEN_BITS 10
+
+static unsigned int ofs_workers = 4;
+module_param(ofs_workers, uint, 0644);
+MODULE_PARM_DESC(ofs_workers, "Number of workers of a parallel scan " \
+		"(OFS_MODE_PARALLEL, 1-" __stringify(OFS_MAX_WORKERS) ")");
+
+static bool ofs_index;
+module_param(ofs_index, bool, 0444);
+MODULE_PARM_DESC(ofs_index, "Maintain an index of all open files " \
+		"(OFS_MODE_INDEX)");
+
+static unsigned int ofs_cache_ttl_ms;
+module_param(ofs_cache_ttl_ms, uint, 0644);
+MODULE_PARM_DESC(ofs_cache_ttl_ms, "Time in milliseconds the results of " \
+		"OFS_UID and OFS_OWNER searches are shared by later searches " \
+		"(0 = no cache)");
+
+// the number of searches served from / not found in the cache
+// (protected by ofs_cache_lock_)
+static unsigned long ofs_cache_hits_;
+module_param_named(ofs_cache_hits, ofs_cache_hits_, ulong, 0444);
+MODULE_PARM_DESC(ofs_cache_hits, "Number of searches served from the cache");
+static unsigned long ofs_cache_misses_;
+module_param_named(ofs_cache_misses, ofs_cache_misses_, ulong, 0444);
+MODULE_PARM_DESC(ofs_cache_misses, "Number of cacheable searches that " \
+		"scanned");
+
+static bool ofs_verbose;
+module_param(ofs_verbose, bool, 0644);
+MODULE_PARM_DESC(ofs_verbose, "Log every open, search and read " \
+		"(KERN_INFO)");
+
+/*
+ * Logs per-call information (open, search commands, reads) only if the
+ * module parameter ofs_verbose is set: printk() on every call is expensive
+ * and floods the log under load.
+ */
+#define ofs_info(fmt, ...) \
+	do { \
+		if (unlikely(READ_ONCE(ofs_verbose))) { \
+			printk(KERN_INFO "openFileSearch: " fmt, \
+					##__VA_ARGS__); \
+		} \
+	} while (0)
 
 static int major_num_;
-static bool device_opened_ = 0;
-static struct ofs_result *results_;
-static bool search_performed_;
-static unsigned int result_count_;
-static int read_position_;
+
+// the workqueue of parallel scans (unbound -> workers run on any CPU)
+static struct workqueue_struct *ofs_scan_wq_;
+
+typedef int (*ofs_result_filter)(struct ofs_result *, void *);
+
+/*
+ * Fields of struct ofs_result, ordered by the cost of building them.
+ */
+#define OFS_FIELD_TASK	0x1 // pid, uid (known per task)
+#define OFS_FIELD_INODE	0x2 // permissions, owner, fsize, inode_no
+#define OFS_FIELD_NAME	0x4 // name (requires d_path())
+#define OFS_FIELD_ALL	(OFS_FIELD_TASK | OFS_FIELD_INODE | OFS_FIELD_NAME)
+
+// not a field: reported along with OFS_FIELD_NAME if the short name is used
+#define OFS_FIELD_SHORT_NAME	0x8
+
+/*
+ * Hash tables of the open file index (OFS_MODE_INDEX).
+ */
+#define OFS_INDEX_BY_INODE	0
+#define OFS_INDEX_BY_UID	1 // uid of the process
+#define OFS_INDEX_BY_OWNER	2 // owner of the file
+#define OFS_INDEX_TABLES	3
+
+/**
+ * A filter of open files.
+ *
+ * Only the fields declared in fields are built before match is called; the
+ * remaining fields are built for matching results only.
+ */
+struct ofs_filter {
+	/*
+	 * Decides on a whole task before its fd table is touched (or NULL)
+	 * Called with task_lock() held.
+	 */
+	int (*match_task)(struct task_struct *task, uid_t uid,
+			void *filter_arg);
+
+	/*
+	 * Decides on an open file before any other field than OFS_FIELD_TASK
+	 * is built (or NULL). Fields the filter builds on its own are added to
+	 * *built.
+	 */
+	int (*match_file)(struct file *open_fd, struct ofs_result *result,
+			unsigned int *built, void *filter_arg);
+
+	/* The fields of struct ofs_result required by match */
+	unsigned int fields;
+
+	/* Decides on a single open file (or NULL to match all) */
+	ofs_result_filter match;
+
+	/*
+	 * Looks up the key of the index table (OFS_INDEX_BY_*) the filter can
+	 * be served from (or NULL if it cannot be served from the index).
+	 * Returns the table or a negative error code. Entries of the key are
+	 * only candidates, they still have to pass the filter.
+	 */
+	int (*index_key)(void *filter_arg, unsigned long *key);
+};
+
+/**
+ * The tasks searches are restricted to (OFS_SET_SCOPE). References to the
+ * pid namespace and the cgroup are held.
+ */
+struct ofs_task_scope {
+	/* Only tasks visible in this pid namespace (or NULL) */
+	struct pid_namespace *pid_ns;
+
+	/* Only tasks in this cgroup or its descendants (or NULL) */
+	struct cgroup *cgroup;
+};
+
+/**
+ * The criteria of a search.
+ */
+struct ofs_query {
+	/* The filter applied to every open file */
+	const struct ofs_filter *filter;
+
+	/* The pid of the only process to be searched (0 = all processes) */
+	pid_t pid;
+
+	/* The struct pid of pid resolved in the caller's pid namespace by the
+	 * ioctl (reference held, or NULL); workers must not resolve pid
+	 * themselves (kworkers live in the initial pid namespace) */
+	struct pid *pid_ref;
+
+	/* The argument passed to the filter */
+	union ofs_filter_arg {
+		unsigned int id;
+		char name[OFS_RESULT_NAME_MAX_LENGTH];
+		struct {
+			struct inode *inode;
+			struct super_block *sb;
+		} file;
+		struct {
+			struct path *dir;
+			struct mnt_namespace *mnt_ns;
+		} subtree;
+		struct ofs_prog *prog;
+	} arg;
+
+	/* A path the query holds a reference to (dentry is NULL if none) */
+	struct path path;
+
+	/* The compiled program of OFS_PROGRAM (or NULL) */
+	struct ofs_prog *prog;
+
+	/* Whether results are streamed regardless of OFS_MODE_STREAM */
+	bool stream;
+
+	/* The tasks the search is restricted to (the session's, or NULL) */
+	const struct ofs_task_scope *scope;
+
+	/* The pid namespace of the caller pids are reported in (reference
+	 * held, or NULL) */
+	struct pid_namespace *pid_ns;
+};
+
+/**
+ * The groups of an aggregation (OFS_AGGREGATE): an open addressing hash
+ * table of at most capacity groups, filled during the scan without
+ * allocating memory.
+ */
+struct ofs_aggregation {
+	/* The key of the groups (OFS_GROUP_BY_*) */
+	unsigned int group_by;
+
+	/* The slots of the hash table (a group with count 0 is empty) */
+	struct ofs_group *groups;
+
+	/* The number of slots - 1 (at least twice capacity) */
+	unsigned int mask;
+
+	/* log2 of the number of slots */
+	unsigned int bits;
+
+	/* The maximum number of groups */
+	unsigned int capacity;
+
+	/* The number of groups */
+	unsigned int group_count;
+
+	/* The number of matching open files */
+	unsigned long long matches;
+
+	/* The number of matching open files without a free group */
+	unsigned long long dropped;
+};
+
+/**
+ * The top k open files or processes of a ranking (OFS_TOP): a min-heap of at
+ * most k entries, so memory use depends on k only.
+ */
+struct ofs_ranking {
+	/* The rank of the entries (OFS_RANK_*) */
+	unsigned int rank_by;
+
+	/* The entries (heap[0] has the lowest rank) */
+	struct ofs_ranked *heap;
+
+	/* The maximum number of entries */
+	unsigned int k;
+
+	/* The number of entries */
+	unsigned int count;
+
+	/* The number of matching open files */
+	unsigned long long matches;
+
+	/* The number of matching open files of the current task (OFS_RANK_FDS) */
+	unsigned long long task_fds;
+};
+
+/**
+ * An open file seen in the current fd table of a scan (OFS_MODE_DEDUP).
+ * Slots of other fd tables are recognized by gen, so the set is never
+ * cleared.
+ */
+struct ofs_seen_file {
+	struct file *file;
+	unsigned int gen;
+};
+
+/**
+ * A scan of open files and the destination of its results: the session's
+ * result array (also the staging area of ring mode).
+ */
+struct ofs_scan {
+	/* The criteria of the scan */
+	const struct ofs_query *query;
+
+	/* The slots results are built in */
+	struct ofs_result *results;
+
+	/* The number of results found */
+	unsigned int count;
+
+	/* The maximum number of results the scan may produce */
+	unsigned int limit;
+
+	/* Whether fd tables are walked in bounded chunks (OFS_MODE_LOWLAT) */
+	bool lowlat;
+
+	/* The statistics the scan adds to */
+	struct ofs_stats *stats;
+
+	/* The groups matches are counted in instead of being kept (or NULL) */
+	struct ofs_aggregation *aggregation;
+
+	/* The ranking matches are entered in instead of being kept (or NULL) */
+	struct ofs_ranking *ranking;
+
+	/*
+	 * The buffer v2 records are built in (OFS_MODE_V2, or NULL)
+	 * results then only holds the result the filter is applied to.
+	 */
+	char *records;
+
+	/* The number of bytes of records used */
+	unsigned int records_used;
+
+	/* Whether records of sockets and pipes are typed (OFS_MODE_TYPED) */
+	bool typed;
+
+	/* The number of users of the current fd table */
+	unsigned int table_users;
+
+	/*
+	 * The open files of the current fd table referred to by more than one
+	 * fd (1 << OFS_SEEN_BITS slots, OFS_MODE_DEDUP, or NULL)
+	 */
+	struct ofs_seen_file *seen;
+
+	/* The generation of the current fd table in seen */
+	unsigned int seen_gen;
+
+	/* The number of slots of seen used by the current fd table */
+	unsigned int seen_count;
+};
+
+/**
+ * The position of a streaming search (OFS_MODE_STREAM).
+ *
+ * Tasks are identified by pid and start time so a reused pid is not
+ * mistaken for the task that has been searched before.
+ */
+struct ofs_cursor {
+	/* The pid of the current task (0 = no task has been searched yet) */
+	pid_t pid;
+
+	/* The start time of the current task */
+	u64 start_time;
+
+	/* The next fd of the current task to be searched */
+	unsigned int fd;
+
+	/* Whether all fds of the current task have been searched */
+	bool task_done;
+
+	/* Whether all tasks have been searched */
+	bool done;
+
+	/* The index of the current task in the session's tasks (OFS_MODE_DEDUP) */
+	unsigned int index;
+};
+
+/**
+ * An asynchronous search (OFS_MODE_ASYNC).
+ *
+ * The worker is the only producer of fifo, read() (serialized by the
+ * session's lock) the only consumer, so no lock is needed around the fifo.
+ * While the worker runs it owns the session's query, cursor, scan and
+ * result array.
+ */
+struct ofs_async {
+	/* The worker producing the results (on the scan workqueue) */
+	struct work_struct work;
+
+	/* The results that have not been read yet (OFS_MAX_RESULTS entries) */
+	DECLARE_KFIFO_PTR(fifo, struct ofs_result);
+
+	/* Woken when results are available or the search has finished */
+	wait_queue_head_t ready;
+
+	/* Whether the worker has been queued and not been cancelled */
+	bool active;
+
+	/* Set by the worker when all results have been produced */
+	bool done;
+
+	/* Tells the worker to stop */
+	bool cancel;
+};
+
+/**
+ * The events of a subscription produced on one CPU.
+ *
+ * Single producer (the probes running on the CPU) / single consumer
+ * (read() under the session's lock). Indices are free running.
+ */
+struct ofs_event_ring {
+	/* The index of the next event to be produced (written by the probes) */
+	unsigned int head;
+
+	/* The number of events lost because the ring was full (ditto) */
+	unsigned long lost;
+
+	/* The index of the next event to be read (written by read()) */
+	unsigned int tail ____cacheline_aligned_in_smp;
+
+	/* The number of lost events reported by read() */
+	unsigned long reported;
+
+	struct ofs_event events[OFS_EVENT_RING_SIZE];
+};
+
+/**
+ * A subscription to open/close events (OFS_SUBSCRIBE).
+ *
+ * The rings are allocated by the first subscription of a session and reused
+ * until the session is released, so readers and poll() never see them go
+ * away.
+ */
+struct ofs_subscription {
+	/* The entry in ofs_subscribers_ */
+	struct list_head list;
+
+	/* The criteria events are filtered by (the session's query) */
+	const struct ofs_query *query;
+
+	/* One ring per possible CPU (or NULL) */
+	struct ofs_event_ring *rings;
+
+	/* Woken when events are available or the subscription ends */
+	wait_queue_head_t *wait;
+
+	/* Whether the subscription is fed by the probes */
+	bool active;
+
+	/* The CPU whose ring is read first by the next read() */
+	unsigned int next_cpu;
+};
+
+/**
+ * The immutable results of a search shared by the searches with the same
+ * criteria until it expires (module parameter ofs_cache_ttl_ms).
+ *
+ * Referenced by the cache (until it expires or is replaced) and by every
+ * session reading it.
+ */
+struct ofs_snapshot {
+	struct kref ref;
+
+	/* The entry in ofs_cache_ (protected by ofs_cache_lock_) */
+	struct list_head list;
+
+	/* The criteria of the search (filter, its argument and the pid
+	 * namespace pids are reported in, reference held) */
+	const struct ofs_filter *filter;
+	unsigned int id;
+	struct pid_namespace *pid_ns;
+
+	/* The root of the caller names are built relative to by d_path()
+	 * (reference held) */
+	struct path root;
+
+	/* Whether the results are de-duplicated (OFS_MODE_DEDUP) */
+	bool dedup;
+
+	/* When the snapshot expires (ktime_get_ns()) */
+	u64 expires;
+
+	/* The results */
+	unsigned int count;
+	struct ofs_result results[];
+};
+
+/**
+ * The search state of a single open() of the device.
+ *
+ * Every caller gets its own session (stored in file::private_data) so
+ * independent callers can search concurrently.
+ */
+struct ofs_session {
+	/* Serializes ioctl() and read() of callers sharing this open file */
+	struct mutex lock;
+
+	/* Bitmask of OFS_MODE_* flags applied to the next search */
+	unsigned int mode;
+
+	/* The criteria of the current search */
+	struct ofs_query query;
+
+	/* The position of the current search (OFS_MODE_STREAM only) */
+	struct ofs_cursor cursor;
+
+	/*
+	 * The result array (OFS_MAX_RESULTS entries)
+	 * In streaming mode it is only used as a bounce buffer between the
+	 * scan (which holds spinlocks) and copy_to_user().
+	 */
+	struct ofs_result *results;
+
+	/* The current (or last) scan; scan.count results are available */
+	struct ofs_scan scan;
+
+	/*
+	 * The cached results of the current search (or NULL)
+	 * If set they are read instead of the result array.
+	 */
+	struct ofs_snapshot *snapshot;
+
+	/* The statistics of the current search */
+	struct ofs_stats stats;
+
+	/* The asynchronous search (OFS_MODE_ASYNC only) */
+	struct ofs_async async;
+
+	/* The subscription to open/close events (OFS_SUBSCRIBE only) */
+	struct ofs_subscription sub;
+
+	/* Woken when events of the subscription are available */
+	wait_queue_head_t events;
+
+	/* Whether the current search command subscribes instead of searching */
+	bool subscribing;
+
+	/* The groups the current search command aggregates into (or NULL) */
+	struct ofs_aggregation *aggregation;
+
+	/* The ranking the current search command enters matches in (or NULL) */
+	struct ofs_ranking *ranking;
+
+	/* The result limit of the current search command of a batch (OFS_BATCH)
+	 * or 0 */
+	unsigned int batch_limit;
+
+	/* The tasks all searches are restricted to (OFS_SET_SCOPE) */
+	struct ofs_task_scope scope;
+
+	/* The buffer v2 records are staged in (OFS_MODE_V2 only) */
+	char *records;
+
+	/* The set of open files seen by the scan (OFS_MODE_DEDUP only) */
+	struct ofs_seen_file *seen;
+
+	/*
+	 * The tasks walked by the cursor (OFS_MODE_DEDUP, references held, or
+	 * NULL)
+	 */
+	struct task_struct **tasks;
+
+	/* The number of tasks */
+	unsigned int task_count;
+
+	/*
+	 * The result ring shared with user space via mmap() (or NULL)
+	 * Published by ofs_mmap() with smp_store_release() after the fields
+	 * below have been set; read with smp_load_acquire() unless a prior
+	 * acquire (e.g. by ofs_set_mode()) is ordered before the access.
+	 */
+	struct ofs_ring_header *ring;
+
+	/* Set (cmpxchg()) by the one mmap() allowed to create the ring */
+	int ring_claimed;
+
+	/* The records of the ring (ring_mask + 1 entries) */
+	struct ofs_result *ring_records;
+
+	/* The number of records of the ring - 1 */
+	unsigned int ring_mask;
+
+	/*
+	 * The kernel's copy of the producer index (the shared one may be
+	 * overwritten by user space)
+	 */
+	unsigned int ring_producer;
+
+	/* Whether a search has been performed and not been read completely */
+	bool search_performed;
+
+	/* The index of the next result to be read */
+	unsigned int read_position;
+};
+
+/*
+ * A compiled OFS_PROGRAM program.
+ *
+ * The instructions are stored in prefix order: an operator is followed by
+ * its operands, the cheaper operand of AND/OR first. len is the number of
+ * instructions of the subtree starting at an instruction, so an operand
+ * can be skipped (short-circuit evaluation).
+ */
+struct ofs_prog {
+	unsigned int length;
+	struct ofs_prog_insn {
+		struct ofs_insn insn;
+		unsigned int len;
+		unsigned int prefix_len;
+	} insns[OFS_PROGRAM_MAX_INSNS];
+};
+
+static void ofs_put_query(struct ofs_query *query) {
+	if (query->path.dentry) {
+		path_put(&query->path);
+		query->path.dentry = NULL;
+	}
+	kfree(query->prog);
+	query->prog = NULL;
+	if (query->pid_ref) {
+		put_pid(query->pid_ref);
+		query->pid_ref = NULL;
+	}
+	if (query->pid_ns) {
+		put_pid_ns(query->pid_ns);
+		query->pid_ns = NULL;
+	}
+}
+
+static void ofs_put_scope(struct ofs_task_scope *scope) {
+	if (scope->pid_ns) {
+		put_pid_ns(scope->pid_ns);
+		scope->pid_ns = NULL;
+	}
+	if (scope->cgroup) {
+		cgroup_put(scope->cgroup);
+		scope->cgroup = NULL;
+	}
+}
+
+static void ofs_async_fn(struct work_struct *work);
+static void ofs_put_snapshot(struct ofs_snapshot *snapshot);
+static void ofs_async_cancel(struct ofs_session *session);
+static void ofs_unsubscribe(struct ofs_session *session);
+static void ofs_put_tasks(struct task_struct **tasks, unsigned int count);
 
 static int ofs_open(struct inode *inode, struct file *flip) {
-	// do not allow concurrent use (static members would cause race
-	// conditions!)
-	if (device_opened_) {
-		printk(KERN_WARNING "openFileSearch: Driver already in use\n");
-		return -EBUSY;
+	struct ofs_session *session;
+
+	if (!(session = kzalloc(sizeof(*session), GFP_KERNEL))) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for session\n");
+		return -ENOMEM;
+	}
+
+	if (!(session->results = kmalloc(OFS_MAX_RESULTS
+					* sizeof(struct ofs_result),
+					GFP_KERNEL))) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for results\n");
+		kfree(session);
+		return -ENOMEM;
+	}
+
+	mutex_init(&session->lock);
+	INIT_WORK(&session->async.work, &ofs_async_fn);
+	init_waitqueue_head(&session->async.ready);
+	init_waitqueue_head(&session->events);
+	session->sub.wait = &session->events;
+	flip->private_data = session;
+
+	ofs_info("Opened\n");
+	return 0;
+}
+
+static int ofs_release(struct inode *inode, struct file *flip) {
+	struct ofs_session *session = flip->private_data;
+
+	ofs_async_cancel(session);
+	ofs_unsubscribe(session);
+	ofs_put_query(&session->query);
+	ofs_put_scope(&session->scope);
+	if (session->tasks) {
+		ofs_put_tasks(session->tasks, session->task_count);
+	}
+	if (session->snapshot) {
+		ofs_put_snapshot(session->snapshot);
+	}
+	kfifo_free(&session->async.fifo);
+	vfree(session->sub.rings);
+	vfree(session->records);
+	kfree(session->seen);
+	vfree(session->ring);
+	kfree(session->results);
+	kfree(session);
+
+	ofs_info("Released\n");
+	return 0;
+}
+
+int ofs_task_filter_by_uid(struct task_struct *task, uid_t uid,
+		void *filter_arg) {
+	return uid == *(unsigned int *) filter_arg;
+}
+
+// tasks of other mount namespaces cannot see the caller's mounts
+int ofs_task_filter_by_mnt_ns(struct task_struct *task, uid_t uid,
+		void *filter_arg) {
+	union ofs_filter_arg *arg = filter_arg;
+	return task->nsproxy && task->nsproxy->mnt_ns == arg->subtree.mnt_ns;
+}
+
+int ofs_filter_by_owner(struct ofs_result *result, void *filter_arg) {
+	unsigned int owner = *(unsigned int *) filter_arg;
+	return result->owner == owner;
+}
+
+int ofs_filter_by_name(struct ofs_result *result, void *filter_arg) {
+	char * name = (char *) filter_arg;
+	return strncmp(result->name, name, OFS_RESULT_NAME_MAX_LENGTH) == 0;
+}
+
+int ofs_filter_by_inode(struct file *open_fd, struct ofs_result *result,
+		unsigned int *built, void *filter_arg) {
+	union ofs_filter_arg *arg = filter_arg;
+	struct inode *inode = file_inode(open_fd);
+	return inode == arg->file.inode && inode->i_sb == arg->file.sb;
+}
+
+int ofs_filter_by_subtree(struct file *open_fd, struct ofs_result *result,
+		unsigned int *built, void *filter_arg) {
+	union ofs_filter_arg *arg = filter_arg;
+	struct path *dir = arg->subtree.dir;
+
+	if (open_fd->f_path.mnt == dir->mnt) {
+		// same mount -> only the dentry ancestry matters
+		return is_subdir(open_fd->f_path.dentry, dir->dentry);
+	}
+	// a mount below dir (takes mount_lock)
+	return path_is_under(&open_fd->f_path, dir);
+}
+
+int ofs_index_key_by_uid(void *filter_arg, unsigned long *key) {
+	*key = *(unsigned int *) filter_arg;
+	return OFS_INDEX_BY_UID;
+}
+
+int ofs_index_key_by_owner(void *filter_arg, unsigned long *key) {
+	*key = *(unsigned int *) filter_arg;
+	return OFS_INDEX_BY_OWNER;
+}
+
+int ofs_index_key_by_inode(void *filter_arg, unsigned long *key) {
+	union ofs_filter_arg *arg = filter_arg;
+	*key = (unsigned long) arg->file.inode;
+	return OFS_INDEX_BY_INODE;
+}
+
+// the name is resolved to an inode once, candidates are checked by name
+int ofs_index_key_by_name(void *filter_arg, unsigned long *key) {
+	struct path path;
+	int err;
+
+	if ((err = kern_path((char *) filter_arg, 0, &path))) {
+		// e.g. "socket:[295]"
+		return err;
+	}
+	// only compared with the inodes of the index
+	*key = (unsigned long) d_inode(path.dentry);
+	path_put(&path);
+	return OFS_INDEX_BY_INODE;
+}
+
+static const struct ofs_filter ofs_no_filter = {
+	.fields = 0,
+};
+
+// the uid is known per task -> tasks of other users are skipped entirely
+static const struct ofs_filter ofs_uid_filter = {
+	.match_task = &ofs_task_filter_by_uid,
+	.fields = 0,
+	.index_key = &ofs_index_key_by_uid,
+};
+
+static const struct ofs_filter ofs_owner_filter = {
+	.fields = OFS_FIELD_INODE,
+	.match = &ofs_filter_by_owner,
+	.index_key = &ofs_index_key_by_owner,
+};
+
+static const struct ofs_filter ofs_name_filter = {
+	.fields = OFS_FIELD_NAME,
+	.match = &ofs_filter_by_name,
+	.index_key = &ofs_index_key_by_name,
+};
+
+// a pointer comparison per open file, no d_path()
+static const struct ofs_filter ofs_inode_filter = {
+	.match_file = &ofs_filter_by_inode,
+	.fields = 0,
+	.index_key = &ofs_index_key_by_inode,
+};
+
+static const struct ofs_filter ofs_subtree_filter = {
+	.match_task = &ofs_task_filter_by_mnt_ns,
+	.match_file = &ofs_filter_by_subtree,
+	.fields = 0,
+};
+
+/*
+ * Builds the name of a result. Returns the fields built (OFS_FIELD_NAME,
+ * plus OFS_FIELD_SHORT_NAME if the path was too long).
+ */
+static unsigned int ofs_path_to_result(struct ofs_result *result,
+		struct path *path) {
+	char *name = d_path(path, result->name, OFS_RESULT_NAME_MAX_LENGTH);
+	char *short_name;
+
+	if (IS_ERR(name)) {
+		if (PTR_ERR(name) == -ENAMETOOLONG) {
+			short_name = path->dentry->d_iname;
+			ofs_info("filename too long, using short version: " \
+					"%s\n", short_name);
+			strlcpy(result->name, short_name,
+					OFS_RESULT_NAME_MAX_LENGTH);
+			return OFS_FIELD_NAME | OFS_FIELD_SHORT_NAME;
+		}
+		printk(KERN_ERR "Failed to build filename\n");
+		strcpy(result->name, "(error)");
+	} else {
+		// d_path() builds the name at the end of the buffer
+		memmove(result->name, name, strlen(name) + 1);
+	}
+	return OFS_FIELD_NAME;
+}
+
+/*
+ * Copies the inode's fields without inode_lock_shared(): it may sleep and
+ * the search holds task_lock(). Each field is read atomically, i_size via
+ * i_size_read().
+ */
+static void ofs_inode_to_result(struct ofs_result *result, struct inode *inode) {
+	result->permissions = READ_ONCE(inode->i_mode);
+	result->owner = (inode->i_uid).val;
+	result->fsize = i_size_read(inode);
+	result->inode_no = inode->i_ino;
+}
+
+/*
+ * Adds the counters of src to dst (maximum of max_lock_ns).
+ */
+static void ofs_stats_add(struct ofs_stats *dst, const struct ofs_stats *src) {
+	dst->max_lock_ns = max(dst->max_lock_ns, src->max_lock_ns);
+	dst->lock_sections += src->lock_sections;
+	dst->tasks += src->tasks;
+	dst->fds += src->fds;
+	dst->d_path_calls += src->d_path_calls;
+	dst->rejected += src->rejected;
+	dst->truncated_names += src->truncated_names;
+	dst->scan_ns += src->scan_ns;
+}
+
+/*
+ * Records an open file passed to the filter; built are the fields built for
+ * it (see ofs_path_to_result()).
+ */
+static inline void ofs_stats_file(struct ofs_stats *stats, unsigned int built,
+		bool passed) {
+	if (built & OFS_FIELD_NAME) {
+		stats->d_path_calls++;
+	}
+	if (built & OFS_FIELD_SHORT_NAME) {
+		stats->truncated_names++;
+	}
+	if (!passed) {
+		stats->rejected++;
+	}
+}
+
+/*
+ * Records a lock section that started at locked_at (ktime_get_ns()).
+ */
+static inline void ofs_stats_lock_held(struct ofs_stats *stats, u64 locked_at) {
+	u64 held = ktime_get_ns() - locked_at;
+
+	stats->lock_sections++;
+	if (held > stats->max_lock_ns) {
+		stats->max_lock_ns = held;
+	}
+}
+
+/*
+ * Returns the slot of the next result: the next free entry of the result
+ * array.
+ */
+static inline struct ofs_result *ofs_result_slot(struct ofs_scan *scan) {
+	if (scan->records) {
+		return scan->results;
+	}
+	return &scan->results[scan->count];
+}
+
+/*
+ * Returns the number of results the scan can still produce: limited by
+ * limit and, with v2 records, by the space left for records of maximum size.
+ */
+static inline unsigned int ofs_scan_room(struct ofs_scan *scan) {
+	unsigned int room = scan->limit - scan->count;
+
+	if (scan->records) {
+		room = min_t(unsigned int, room, (OFS_RECORD_BUFFER_SIZE
+					- scan->records_used)
+				/ OFS_RECORD_MAX_SIZE);
+	}
+	return room;
+}
+
+/*
+ * Returns the size of the typed part of a v2 record of an open file with
+ * this inode (OFS_MODE_TYPED): sockets and anonymous pipes have one, all
+ * other files have none (0).
+ */
+static inline unsigned int ofs_typed_size(struct inode *inode) {
+	umode_t mode = READ_ONCE(inode->i_mode);
+
+	if (S_ISSOCK(mode)) {
+		return sizeof(struct ofs_socket);
+	}
+	// named pipes (FIFOs in a file system) keep their path
+	if (S_ISFIFO(mode) && inode->i_sb->s_magic == PIPEFS_MAGIC) {
+		return sizeof(struct ofs_pipe);
+	}
+	return 0;
+}
+
+/*
+ * Builds the typed part of a socket's record. The fields are read without
+ * lock_sock(): it may sleep and the search holds task_lock(). The peer of
+ * an AF_UNIX socket is read under unix_state_lock(), which keeps the
+ * socket's reference to its peer.
+ */
+static void ofs_socket_to_record(struct ofs_socket *typed,
+		struct file *open_fd) {
+	struct socket *sock;
+	struct sock *sk;
+	struct sock *peer;
+	int err;
+
+	memset(typed, 0, sizeof(*typed));
+	if (!(sock = sock_from_file(open_fd, &err))
+			|| !(sk = READ_ONCE(sock->sk))) {
+		// released while the file is being closed
+		return;
+	}
+
+	typed->family = sk->sk_family;
+	typed->type = sk->sk_type;
+	typed->protocol = sk->sk_protocol;
+	typed->state = READ_ONCE(sk->sk_state);
+
+	switch (sk->sk_family) {
+		case AF_INET:
+			typed->local_port = READ_ONCE(sk->sk_num);
+			typed->remote_port = ntohs(READ_ONCE(sk->sk_dport));
+			memcpy(typed->local_addr, &sk->sk_rcv_saddr,
+					sizeof(sk->sk_rcv_saddr));
+			memcpy(typed->remote_addr, &sk->sk_daddr,
+					sizeof(sk->sk_daddr));
+			break;
+#if IS_ENABLED(CONFIG_IPV6)
+		case AF_INET6:
+			typed->local_port = READ_ONCE(sk->sk_num);
+			typed->remote_port = ntohs(READ_ONCE(sk->sk_dport));
+			memcpy(typed->local_addr, &sk->sk_v6_rcv_saddr,
+					sizeof(sk->sk_v6_rcv_saddr));
+			memcpy(typed->remote_addr, &sk->sk_v6_daddr,
+					sizeof(sk->sk_v6_daddr));
+			break;
+#endif
+		case AF_UNIX:
+			unix_state_lock(sk);
+			if ((peer = unix_sk(sk)->peer)) {
+				typed->peer_inode = sock_i_ino(peer);
+			}
+			unix_state_unlock(sk);
+			break;
+	}
+}
+
+/*
+ * Builds the typed part of an anonymous pipe's record.
+ */
+static void ofs_pipe_to_record(struct ofs_pipe *typed, struct file *open_fd,
+		struct inode *inode) {
+	struct pipe_inode_info *pipe = READ_ONCE(inode->i_pipe);
+
+	memset(typed, 0, sizeof(*typed));
+	if (open_fd->f_mode & FMODE_READ) {
+		typed->end |= OFS_PIPE_READ;
+	}
+	if (open_fd->f_mode & FMODE_WRITE) {
+		typed->end |= OFS_PIPE_WRITE;
+	}
+	if (pipe) {
+		typed->readers = READ_ONCE(pipe->readers);
+		typed->writers = READ_ONCE(pipe->writers);
+		typed->buffers = READ_ONCE(pipe->nrbufs);
+	}
+}
+
+/*
+ * Builds a v2 record of a matching open file at the end of the scan's
+ * records. Fields are read directly from the file and inode; the path is
+ * built by d_path() in place. Sockets and anonymous pipes get a typed part
+ * instead of a path in OFS_MODE_TYPED.
+ */
+static unsigned int ofs_record_result(struct ofs_scan *scan, pid_t pid,
+		uid_t uid, struct file *open_fd) {
+	struct ofs_record *record =
+		(struct ofs_record *) (scan->records + scan->records_used);
+	struct inode *inode = file_inode(open_fd);
+	unsigned int built = OFS_FIELD_ALL;
+	unsigned int typed_size = 0;
+	void *typed;
+	char *name;
+	unsigned int length;
+	unsigned int size;
+
+	record->pid = pid;
+	record->uid = uid;
+	record->owner = inode->i_uid.val;
+	record->mode = READ_ONCE(inode->i_mode);
+	record->flags = READ_ONCE(open_fd->f_flags);
+	record->dev = new_encode_dev(inode->i_sb->s_dev);
+	record->fsize = i_size_read(inode);
+	record->inode_no = inode->i_ino;
+	record->pos = READ_ONCE(open_fd->f_pos);
+	record->table_users = scan->table_users;
+	// a low-latency scan holds a reference itself
+	record->file_refs = file_count(open_fd) - scan->lowlat;
+
+	if (scan->typed && (typed_size = ofs_typed_size(inode))) {
+		// the typed part replaces the path (no d_path())
+		built &= ~OFS_FIELD_NAME;
+		length = 0;
+		record->path[0] = '\0';
+	} else {
+		// ofs_scan_room() guarantees PATH_MAX bytes for the path
+		name = d_path(&open_fd->f_path, record->path, PATH_MAX);
+		if (IS_ERR(name)) {
+			name = open_fd->f_path.dentry->d_iname;
+			built |= OFS_FIELD_SHORT_NAME;
+		}
+		length = strlen(name);
+		// d_path() builds the name at the end of the buffer
+		memmove(record->path, name, length + 1);
+	}
+
+	size = ALIGN(sizeof(*record) + length + 1, 8);
+	memset(record->path + length + 1, 0,
+			size - sizeof(*record) - length - 1);
+	if (typed_size) {
+		// at OFS_RECORD_TYPED_OFFSET(0), sizes are multiples of 8
+		typed = (char *) record + size;
+		if (S_ISSOCK(record->mode)) {
+			ofs_socket_to_record(typed, open_fd);
+		} else {
+			ofs_pipe_to_record(typed, open_fd, inode);
+		}
+		size += typed_size;
+	}
+	record->path_length = length;
+	record->size = size;
+	scan->records_used += size;
+	scan->count++;
+	return built;
+}
+
+/*
+ * Starts a new fd table in the set of seen open files.
+ */
+static inline void ofs_seen_reset(struct ofs_scan *scan) {
+	if (!++scan->seen_gen) {
+		// all slots may be mistaken for the new fd table
+		memset(scan->seen, 0, sizeof(*scan->seen) << OFS_SEEN_BITS);
+		scan->seen_gen = 1;
+	}
+	scan->seen_count = 0;
+}
+
+/*
+ * Returns true if an open file has already been seen at a lower fd of the
+ * current fd table (OFS_MODE_DEDUP) and adds it to the set otherwise.
+ *
+ * A file referred to by a single fd is never looked up. Once half of the
+ * slots are used, further files are not added (and not collapsed).
+ */
+static bool ofs_seen_file(struct ofs_scan *scan, struct file *file) {
+	struct ofs_seen_file *seen;
+	unsigned int slot;
+
+	if (file_count(file) == 1) {
+		return false;
+	}
+
+	for (slot = hash_ptr(file, OFS_SEEN_BITS);;
+			slot = (slot + 1) & ((1 << OFS_SEEN_BITS) - 1)) {
+		seen = &scan->seen[slot];
+		if (seen->gen != scan->seen_gen) {
+			if (scan->seen_count < (1 << OFS_SEEN_BITS) / 2) {
+				seen->file = file;
+				seen->gen = scan->seen_gen;
+				scan->seen_count++;
+			}
+			return false;
+		}
+		if (seen->file == file) {
+			return true;
+		}
+	}
+}
+
+/*
+ * Builds the given fields (OFS_FIELD_*) of a result. Returns the fields built
+ * (see ofs_path_to_result()).
+ */
+static unsigned int ofs_build_result(struct ofs_result *result,
+		unsigned int fields, pid_t pid, uid_t uid,
+		struct file *open_fd) {
+	if (fields & OFS_FIELD_TASK) {
+		result->pid = pid;
+		result->uid = uid;
+	}
+	if (fields & OFS_FIELD_INODE) {
+		ofs_inode_to_result(result, file_inode(open_fd));
+	}
+	if (fields & OFS_FIELD_NAME) {
+		fields |= ofs_path_to_result(result, &open_fd->f_path);
+	}
+	return fields;
+}
+
+/*
+ * Returns the estimated cost of evaluating a leaf instruction.
+ */
+static unsigned int ofs_insn_cost(const struct ofs_insn *insn) {
+	switch (insn->op) {
+		case OFS_OP_PID:
+		case OFS_OP_UID:
+			return 1; // known per task
+		case OFS_OP_OWNER:
+		case OFS_OP_TYPE:
+		case OFS_OP_FLAGS:
+		case OFS_OP_SIZE:
+			return 2; // file or inode field
+		default:
+			return 16; // OFS_OP_NAME_PREFIX requires d_path()
+	}
+}
+
+/*
+ * Validates a program in postfix order and compiles it into prefix order
+ * with the cheaper operand of each AND/OR first.
+ *
+ * No recursion: the expression tree is built with an explicit stack and
+ * emitted by an iterative depth-first traversal.
+ */
+static int ofs_prog_compile(struct ofs_prog *prog,
+		const struct ofs_program *program) {
+	unsigned int children[OFS_PROGRAM_MAX_INSNS][2];
+	unsigned int cost[OFS_PROGRAM_MAX_INSNS];
+	unsigned int size[OFS_PROGRAM_MAX_INSNS];
+	unsigned int stack[OFS_PROGRAM_MAX_INSNS];
+	unsigned int sp = 0;
+	unsigned int i;
+	unsigned int a;
+	unsigned int b;
+	unsigned int node;
+	const struct ofs_insn *insn;
+
+	if (!program->length || program->length > OFS_PROGRAM_MAX_INSNS) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < program->length; i++) {
+		insn = &program->insns[i];
+		switch (insn->op) {
+			case OFS_OP_NOT:
+				if (sp < 1) {
+					return -EINVAL;
+				}
+				a = stack[--sp];
+				children[i][0] = a;
+				cost[i] = cost[a];
+				size[i] = size[a] + 1;
+				break;
+			case OFS_OP_AND:
+			case OFS_OP_OR:
+				if (sp < 2) {
+					return -EINVAL;
+				}
+				b = stack[--sp];
+				a = stack[--sp];
+				if (cost[b] < cost[a]) {
+					// evaluate the cheaper operand first
+					swap(a, b);
+				}
+				children[i][0] = a;
+				children[i][1] = b;
+				cost[i] = cost[a] + cost[b];
+				size[i] = size[a] + size[b] + 1;
+				break;
+			case OFS_OP_TYPE:
+				if (insn->value & ~S_IFMT) {
+					return -EINVAL;
+				}
+				goto leaf;
+			case OFS_OP_SIZE:
+				if (insn->min > insn->max) {
+					return -EINVAL;
+				}
+				goto leaf;
+			case OFS_OP_NAME_PREFIX:
+				if (strnlen(insn->prefix, OFS_RESULT_NAME_MAX_LENGTH)
+						== OFS_RESULT_NAME_MAX_LENGTH) {
+					return -EINVAL;
+				}
+				goto leaf;
+			case OFS_OP_PID:
+			case OFS_OP_UID:
+			case OFS_OP_OWNER:
+			case OFS_OP_FLAGS:
+leaf:
+				cost[i] = ofs_insn_cost(insn);
+				size[i] = 1;
+				break;
+			default:
+				return -EINVAL;
+		}
+		// sp < i + 1 <= OFS_PROGRAM_MAX_INSNS
+		stack[sp++] = i;
+	}
+
+	if (sp != 1) {
+		return -EINVAL;
+	}
+
+	// emit in prefix order
+	prog->length = 0;
+	while (sp) {
+		node = stack[--sp];
+		prog->insns[prog->length].insn = program->insns[node];
+		prog->insns[prog->length].len = size[node];
+		prog->insns[prog->length].prefix_len =
+			strnlen(program->insns[node].prefix,
+					OFS_RESULT_NAME_MAX_LENGTH);
+		prog->length++;
+
+		switch (program->insns[node].op) {
+			case OFS_OP_AND:
+			case OFS_OP_OR:
+				stack[sp++] = children[node][1];
+				// fall through
+			case OFS_OP_NOT:
+				stack[sp++] = children[node][0];
+		}
+	}
+	return 0;
+}
+
+static int ofs_prog_eval_leaf(const struct ofs_prog_insn *prog_insn,
+		struct file *open_fd, struct ofs_result *result,
+		unsigned int *built) {
+	const struct ofs_insn *insn = &prog_insn->insn;
+	struct inode *inode = file_inode(open_fd);
+	loff_t size;
+
+	switch (insn->op) {
+		case OFS_OP_PID:
+			return result->pid == (pid_t) insn->value;
+		case OFS_OP_UID:
+			return result->uid == insn->value;
+		case OFS_OP_OWNER:
+			return inode->i_uid.val == insn->value;
+		case OFS_OP_TYPE:
+			return (READ_ONCE(inode->i_mode) & S_IFMT) == insn->value;
+		case OFS_OP_FLAGS:
+			return (open_fd->f_flags & insn->value) == insn->value;
+		case OFS_OP_SIZE:
+			size = i_size_read(inode);
+			return size >= insn->min && size <= insn->max;
+		default: // OFS_OP_NAME_PREFIX
+			if (!(*built & OFS_FIELD_NAME)) {
+				*built |= ofs_path_to_result(result,
+						&open_fd->f_path);
+			}
+			return strncmp(result->name, insn->prefix,
+					prog_insn->prefix_len) == 0;
+	}
+}
+
+/*
+ * Evaluates a compiled program with short-circuit semantics. The stack of
+ * pending operators is bounded by the program length.
+ */
+int ofs_filter_by_prog(struct file *open_fd, struct ofs_result *result,
+		unsigned int *built, void *filter_arg) {
+	const struct ofs_prog *prog = ((union ofs_filter_arg *) filter_arg)->prog;
+	struct {
+		unsigned int pc;
+		bool second;
+	} stack[OFS_PROGRAM_MAX_INSNS];
+	unsigned int sp = 0;
+	unsigned int pc = 0;
+	unsigned int op;
+	int value;
+
+	for (;;) {
+		op = prog->insns[pc].insn.op;
+		if (op == OFS_OP_AND || op == OFS_OP_OR || op == OFS_OP_NOT) {
+			stack[sp].pc = pc++;
+			stack[sp++].second = 0;
+			continue;
+		}
+		value = ofs_prog_eval_leaf(&prog->insns[pc++], open_fd, result,
+				built);
+
+		// pass the value up to the pending operators
+		while (sp) {
+			op = prog->insns[stack[sp - 1].pc].insn.op;
+			if (op == OFS_OP_NOT) {
+				value = !value;
+				sp--;
+			} else if (stack[sp - 1].second
+					|| value == (op == OFS_OP_OR)) {
+				// both operands evaluated or short-circuit
+				pc = stack[sp - 1].pc
+					+ prog->insns[stack[sp - 1].pc].len;
+				sp--;
+			} else {
+				// evaluate the second operand
+				stack[sp - 1].second = 1;
+				break;
+			}
+		}
+		if (!sp) {
+			return value;
+		}
+	}
+}
+
+static const struct ofs_filter ofs_prog_filter = {
+	.match_file = &ofs_filter_by_prog,
+	.fields = 0,
+};
+
+/*
+ * Counts a matching open file in its group. Only the fields of
+ * OFS_FIELD_TASK have been built; the inode is read directly.
+ */
+static void ofs_aggregate_result(struct ofs_aggregation *aggregation,
+		struct ofs_result *result, struct file *open_fd) {
+	struct inode *inode = file_inode(open_fd);
+	struct ofs_group *group;
+	unsigned long long key;
+	unsigned int dev = 0;
+	unsigned int slot;
+
+	switch (aggregation->group_by) {
+		case OFS_GROUP_BY_UID:
+			key = result->uid;
+			break;
+		case OFS_GROUP_BY_PID:
+			key = result->pid;
+			break;
+		default: // OFS_GROUP_BY_FILE
+			key = inode->i_ino;
+			dev = new_encode_dev(inode->i_sb->s_dev);
+	}
+	aggregation->matches++;
+
+	// linear probing, at most half of the slots are used
+	for (slot = hash_64(key ^ ((u64) dev << 32), aggregation->bits);;
+			slot = (slot + 1) & aggregation->mask) {
+		group = &aggregation->groups[slot];
+		if (!group->count) {
+			if (aggregation->group_count == aggregation->capacity) {
+				aggregation->dropped++;
+				return;
+			}
+			group->key = key;
+			group->dev = dev;
+			aggregation->group_count++;
+			break;
+		}
+		if (group->key == key && group->dev == dev) {
+			break;
+		}
+	}
+	group->count++;
+	group->total_size += i_size_read(inode);
+}
+
+/*
+ * Returns the pid of a task as seen from the caller's pid namespace (0 if it
+ * is not visible there).
+ */
+static inline pid_t ofs_task_pid(const struct ofs_query *query,
+		struct task_struct *task) {
+	return query->pid_ns ? task_pid_nr_ns(task, query->pid_ns) : task->pid;
+}
+
+/*
+ * Returns a pid of the initial pid namespace (as kept by the index) as seen
+ * from the caller's pid namespace (0 if it is not visible there).
+ */
+static pid_t ofs_pid_in_ns(const struct ofs_query *query, pid_t pid) {
+	pid_t nr;
+
+	if (!query->pid_ns) {
+		return pid;
+	}
+	rcu_read_lock();
+	nr = pid_nr_ns(find_pid_ns(pid, &init_pid_ns), query->pid_ns);
+	rcu_read_unlock();
+	return nr;
+}
+
+/*
+ * Returns whether a task belongs to the scope of a query (OFS_SET_SCOPE).
+ * Only the task's pid and cgroup are looked at, not its fd table.
+ */
+static bool ofs_task_in_scope(const struct ofs_query *query,
+		struct task_struct *task) {
+	const struct ofs_task_scope *scope = query->scope;
+	bool in_scope = true;
+
+	if (!scope) {
+		return true;
+	}
+	if (scope->pid_ns && !task_pid_nr_ns(task, scope->pid_ns)) {
+		return false;
+	}
+	if (scope->cgroup) {
+		rcu_read_lock();
+		in_scope = task_under_cgroup_hierarchy(task, scope->cgroup);
+		rcu_read_unlock();
+	}
+	return in_scope;
+}
+
+static void ofs_ranking_sift_up(struct ofs_ranked *heap, unsigned int i) {
+	while (i && heap[i].rank < heap[(i - 1) / 2].rank) {
+		swap(heap[i], heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+}
+
+static void ofs_ranking_sift_down(struct ofs_ranked *heap, unsigned int count,
+		unsigned int i) {
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < count) {
+		if (child + 1 < count && heap[child + 1].rank < heap[child].rank) {
+			child++;
+		}
+		if (heap[i].rank <= heap[child].rank) {
+			break;
+		}
+		swap(heap[i], heap[child]);
+		i = child;
+	}
+}
+
+/*
+ * Returns the entry a candidate of the given rank is written to or NULL if
+ * it does not rank among the top k. ofs_ranking_insert() must be called
+ * after writing the entry.
+ */
+static inline struct ofs_ranked *ofs_ranking_slot(struct ofs_ranking *ranking,
+		u64 rank) {
+	if (ranking->count < ranking->k) {
+		return &ranking->heap[ranking->count];
+	}
+	if (rank <= ranking->heap[0].rank) {
+		return NULL;
+	}
+	// replaces the lowest entry
+	return &ranking->heap[0];
+}
+
+static inline void ofs_ranking_insert(struct ofs_ranking *ranking) {
+	if (ranking->count < ranking->k) {
+		ofs_ranking_sift_up(ranking->heap, ranking->count++);
+	} else {
+		ofs_ranking_sift_down(ranking->heap, ranking->count, 0);
+	}
+}
+
+/*
+ * Enters a matching open file in the ranking. Only the fields in built have
+ * been built; the remaining fields are built only if the file ranks among
+ * the top k (OFS_RANK_SIZE). With OFS_RANK_FDS the file is only counted for
+ * its task. Returns the fields built.
+ */
+static unsigned int ofs_rank_result(struct ofs_ranking *ranking,
+		struct ofs_result *result, unsigned int built,
+		struct file *open_fd) {
+	struct ofs_ranked *entry;
+	u64 size;
+
+	ranking->matches++;
+	if (ranking->rank_by == OFS_RANK_FDS) {
+		ranking->task_fds++;
+		return built;
+	}
+
+	size = i_size_read(file_inode(open_fd));
+	if (!(entry = ofs_ranking_slot(ranking, size))) {
+		return built;
+	}
+	entry->rank = size;
+	entry->result = *result;
+	built |= ofs_build_result(&entry->result, OFS_FIELD_ALL & ~built,
+			result->pid, result->uid, open_fd);
+	ofs_ranking_insert(ranking);
+	return built;
+}
+
+/*
+ * Enters a task in the ranking by the number of its matching open files
+ * (OFS_RANK_FDS) once all of them have been searched. The name of the
+ * result is the command name of the task.
+ */
+static void ofs_rank_task(struct ofs_ranking *ranking,
+		struct task_struct *task, pid_t pid) {
+	struct ofs_ranked *entry;
+	u64 fds = ranking->task_fds;
+
+	ranking->task_fds = 0;
+	if (!fds || !(entry = ofs_ranking_slot(ranking, fds))) {
+		return;
+	}
+	memset(entry, 0, sizeof(*entry));
+	entry->rank = fds;
+	entry->result.pid = pid;
+	rcu_read_lock();
+	entry->result.uid = rcu_dereference(task->cred)->uid.val;
+	rcu_read_unlock();
+	get_task_comm(entry->result.name, task);
+	ofs_ranking_insert(ranking);
+}
+
+/*
+ * Builds only the fields the filter needs, applies the filter and builds
+ * the remaining fields if the open file passes.
+ */
+static void ofs_filter_result(struct ofs_scan *scan, pid_t pid, uid_t uid,
+		struct file *open_fd) {
+	const struct ofs_filter *filter = scan->query->filter;
+	union ofs_filter_arg *filter_arg =
+		(union ofs_filter_arg *) &scan->query->arg;
+	struct ofs_result *result = ofs_result_slot(scan);
+	unsigned int built = OFS_FIELD_TASK;
+	bool passed = false;
+
+	// the result will be overwritten by the next result if filtered out
+	ofs_build_result(result, OFS_FIELD_TASK, pid, uid, open_fd);
+	if (filter->match_file && !filter->match_file(open_fd, result, &built,
+				filter_arg)) {
+		goto out;
+	}
+
+	built |= ofs_build_result(result, filter->fields & ~built, pid, uid,
+			open_fd);
+	if (filter->match && !filter->match(result, filter_arg)) {
+		goto out;
+	}
+	passed = true;
+
+	if (scan->aggregation) {
+		// no result is kept -> the remaining fields are never built
+		ofs_aggregate_result(scan->aggregation, result, open_fd);
+	} else if (scan->ranking) {
+		built = ofs_rank_result(scan->ranking, result, built, open_fd);
+	} else if (scan->records) {
+		// the v2 record replaces the remaining fields
+		built = ofs_record_result(scan, pid, uid, open_fd);
+	} else {
+		// include this open file in the results
+		built |= ofs_build_result(result, OFS_FIELD_ALL & ~built, pid,
+				uid, open_fd);
+		scan->count++;
+	}
+
+out:
+	// subscriptions keep no statistics
+	if (scan->stats) {
+		ofs_stats_file(scan->stats, built, passed);
+	}
+}
+
+/*
+ * Searches the open files of a task starting at fd *next_fd.
+ *
+ * Returns true if all open files of the task have been searched and false
+ * if the result limit has been reached. In the latter case *next_fd is set
+ * to the first fd that has not been searched yet.
+ */
+static bool ofs_search(struct ofs_scan *scan, struct task_struct *task,
+		unsigned int *next_fd) {
+	const struct ofs_filter *filter = scan->query->filter;
+	pid_t pid = ofs_task_pid(scan->query, task);
+	uid_t uid;
+	struct files_struct *files;
+	struct fdtable *fdt;
+	unsigned int fd;
+	unsigned int max_fds;
+	struct file *open_fd;
+	u64 locked_at;
+
+	if (!ofs_task_in_scope(scan->query, task)) {
+		return true;
+	}
+
+	rcu_read_lock();
+	uid = rcu_dereference(task->cred)->uid.val;
+	rcu_read_unlock();
+
+	task_lock(task);
+	locked_at = ktime_get_ns();
+	files = task->files;
+	if (!files || (filter->match_task && !filter->match_task(task, uid,
+					(union ofs_filter_arg *)
+					&scan->query->arg))) {
+		// task is exiting or filtered out
+		task_unlock(task);
+		return true;
+	}
+	scan->table_users = atomic_read(&files->count);
+	if (scan->seen && !*next_fd) {
+		ofs_seen_reset(scan);
+	}
+
+	rcu_read_lock();
+	// (see <kernel>/Documentation/filesystems/files.txt)
+	// (files_struct::fdt initially points to files_struct::fdtab but
+	// elsewhere after possible expansion of fdtable)
+	fdt = files_fdtable(files);
+
+	max_fds = fdt->max_fds;
+	for (fd = *next_fd; ofs_scan_room(scan) && fd < max_fds; fd++) {
+		if (fd_is_open(fd, fdt)) {
+			rcu_read_lock();
+			// it's recommended to use fcheck_files() here
+			// but it would check if fd < max_fds on every call
+			open_fd = rcu_dereference_raw(fdt->fd[fd]);
+			// fd may be allocated but not installed yet
+			// (dup()ed fds are skipped in OFS_MODE_DEDUP)
+			if (open_fd) {
+				scan->stats->fds++;
+				if (!(scan->seen
+						&& ofs_seen_file(scan, open_fd))) {
+					ofs_filter_result(scan, pid, uid,
+							open_fd);
+				}
+			}
+			rcu_read_unlock();
+		}
+	}
+	rcu_read_unlock();
+	ofs_stats_lock_held(scan->stats, locked_at);
+	task_unlock(task);
+
+	*next_fd = fd;
+	return fd >= max_fds;
+}
+
+/*
+ * Searches the open files of a task like ofs_search() but holds locks for at
+ * most OFS_CHUNK_FDS fds at a time (OFS_MODE_LOWLAT).
+ *
+ * References to the files of a chunk are taken under task_lock() and RCU
+ * (get_file_rcu()); the results are built after dropping both, and the
+ * scan reschedules between chunks. The fd table may change between chunks
+ * (like in a streaming search).
+ */
+static bool ofs_search_lowlat(struct ofs_scan *scan, struct task_struct *task,
+		unsigned int *next_fd) {
+	const struct ofs_filter *filter = scan->query->filter;
+	struct file *chunk[OFS_CHUNK_FDS];
+	pid_t pid = ofs_task_pid(scan->query, task);
+	uid_t uid;
+	struct files_struct *files;
+	struct fdtable *fdt;
+	unsigned int fd = *next_fd;
+	unsigned int max_fds;
+	unsigned int chunk_size;
+	unsigned int capacity;
+	unsigned int i;
+	struct file *open_fd;
+	u64 locked_at;
+
+	if (!ofs_task_in_scope(scan->query, task)) {
+		return true;
+	}
+
+	rcu_read_lock();
+	uid = rcu_dereference(task->cred)->uid.val;
+	rcu_read_unlock();
+
+	for (;;) {
+		task_lock(task);
+		locked_at = ktime_get_ns();
+		files = task->files;
+		if (!files || (filter->match_task && !filter->match_task(task,
+						uid, (union ofs_filter_arg *)
+						&scan->query->arg))) {
+			task_unlock(task);
+			return true;
+		}
+		scan->table_users = atomic_read(&files->count);
+		if (scan->seen && !fd) {
+			ofs_seen_reset(scan);
+		}
+
+		// at most one result per file -> never exceed the limit
+		capacity = min_t(unsigned int, OFS_CHUNK_FDS,
+				ofs_scan_room(scan));
+		chunk_size = 0;
+
+		rcu_read_lock();
+		fdt = files_fdtable(files);
+		max_fds = fdt->max_fds;
+		for (; chunk_size < capacity && fd < max_fds; fd++) {
+			if (fd_is_open(fd, fdt)) {
+				open_fd = rcu_dereference_raw(fdt->fd[fd]);
+				if (!open_fd) {
+					continue;
+				}
+				scan->stats->fds++;
+				// skip dup()ed fds (OFS_MODE_DEDUP) and files
+				// that are being closed
+				if (!(scan->seen
+						&& ofs_seen_file(scan, open_fd))
+						&& get_file_rcu(open_fd)) {
+					chunk[chunk_size++] = open_fd;
+				}
+			}
+		}
+		rcu_read_unlock();
+		ofs_stats_lock_held(scan->stats, locked_at);
+		task_unlock(task);
+
+		for (i = 0; i < chunk_size; i++) {
+			ofs_filter_result(scan, pid, uid, chunk[i]);
+			fput(chunk[i]);
+		}
+
+		*next_fd = fd;
+		if (fd >= max_fds) {
+			return true;
+		}
+		if (!ofs_scan_room(scan)) {
+			return false;
+		}
+		cond_resched();
+	}
+}
+
+static inline bool ofs_search_task(struct ofs_scan *scan,
+		struct task_struct *task, unsigned int *next_fd) {
+	bool done;
+
+	if (!*next_fd) {
+		scan->stats->tasks++;
+	}
+	done = scan->lowlat ? ofs_search_lowlat(scan, task, next_fd)
+		: ofs_search(scan, task, next_fd);
+
+	if (done && scan->ranking && scan->ranking->rank_by == OFS_RANK_FDS) {
+		ofs_rank_task(scan->ranking, task,
+				ofs_task_pid(scan->query, task));
+	}
+	return done;
+}
+
+static inline bool ofs_streaming(struct ofs_session *session) {
+	return (session->mode & (OFS_MODE_STREAM | OFS_MODE_V2))
+		|| session->query.stream;
+}
+
+/*
+ * Whether the current search command returns the matching open files itself
+ * (OFS_AGGREGATE, OFS_TOP, OFS_BATCH) instead of keeping results to be read.
+ */
+static inline bool ofs_direct(struct ofs_session *session) {
+	return session->aggregation || session->ranking || session->batch_limit;
+}
+
+/*
+ * Prepares the session's scan: results are built in the record buffer (v2
+ * mode) or the result array (also in ring mode, see ofs_ring_fill()).
+ */
+static void ofs_scan_init(struct ofs_session *session, unsigned int limit) {
+	struct ofs_scan *scan = &session->scan;
+
+	scan->query = &session->query;
+	scan->results = session->results;
+	scan->count = 0;
+	scan->limit = limit;
+	scan->lowlat = session->mode & OFS_MODE_LOWLAT;
+	scan->stats = &session->stats;
+	scan->aggregation = session->aggregation;
+	scan->ranking = session->ranking;
+	scan->records = (session->mode & OFS_MODE_V2)
+		&& !ofs_direct(session) ? session->records : NULL;
+	scan->records_used = 0;
+	scan->typed = session->mode & OFS_MODE_TYPED;
+	scan->seen = session->mode & OFS_MODE_DEDUP ? session->seen : NULL;
+}
+
+static bool ofs_search_all_collected(struct ofs_scan *scan);
+
+static void ofs_search_all(struct ofs_scan *scan) {
+	struct task_struct *task;
+	unsigned int fd;
+	bool lowlat = scan->lowlat;
+
+	if ((scan->lowlat || scan->seen) && ofs_search_all_collected(scan)) {
+		return;
+	}
+
+	// chunks would drop locks and reschedule, which RCU does not allow
+	scan->lowlat = 0;
+	rcu_read_lock();
+	for_each_process(task) {
+		fd = 0;
+		ofs_search_task(scan, task, &fd);
+		if (!ofs_scan_room(scan)) {
+			break;
+		}
+	}
+	rcu_read_unlock();
+	scan->lowlat = lowlat;
+}
+
+/**
+ * A parallel scan of all tasks (OFS_MODE_PARALLEL).
+ */
+struct ofs_parallel_scan {
+	/* The tasks to be searched (with references taken) */
+	struct task_struct **tasks;
+
+	/* The number of tasks */
+	unsigned int task_count;
+
+	/* The index of the next task to be searched by any worker */
+	atomic_t next_task;
+
+	/* The number of results found by all workers */
+	atomic_t found;
+
+	/* The maximum number of results of the whole scan */
+	unsigned int limit;
+};
+
+/**
+ * A worker of a parallel scan. Every worker has its own result buffer.
+ */
+struct ofs_scan_worker {
+	struct work_struct work;
+	struct ofs_parallel_scan *parallel;
+	struct ofs_scan scan;
+	struct ofs_stats stats;
+};
+
+/*
+ * Searches tasks until all tasks have been taken by some worker or enough
+ * results have been found by all workers together. Tasks are taken one at
+ * a time so a task with many open files does not stall a fixed partition.
+ */
+static void ofs_scan_worker_fn(struct work_struct *work) {
+	struct ofs_scan_worker *worker =
+		container_of(work, struct ofs_scan_worker, work);
+	struct ofs_parallel_scan *parallel = worker->parallel;
+	unsigned int index;
+	unsigned int count;
+	unsigned int fd;
+
+	while (atomic_read(&parallel->found) < parallel->limit
+			&& (index = atomic_inc_return(&parallel->next_task) - 1)
+				< parallel->task_count) {
+		count = worker->scan.count;
+		fd = 0;
+		ofs_search_task(&worker->scan, parallel->tasks[index], &fd);
+		atomic_add(worker->scan.count - count, &parallel->found);
+		cond_resched();
+	}
+}
+
+/**
+ * A slot of a set of fd tables: the table (only compared) and the thread
+ * it was found for (with a reference taken by the caller).
+ */
+struct ofs_files_slot {
+	struct files_struct *files;
+	struct task_struct *task;
+};
+
+/*
+ * Adds the fd table of a thread to a set of fd tables (open addressing,
+ * slots is a power of two larger than the number of tables). Returns false
+ * if it has been added before.
+ *
+ * fd tables are not pinned: a table whose threads all dropped it may have
+ * been freed and its memory reused for another table. A table is only
+ * freed once no thread uses it, so an equal pointer is the same table as
+ * long as the thread it was found for still uses it.
+ */
+static bool ofs_add_files(struct ofs_files_slot *set, unsigned int bits,
+		struct files_struct *files, struct task_struct *task) {
+	unsigned int slot;
+	bool used;
+
+	for (slot = hash_ptr(files, bits);; slot = (slot + 1)
+			& ((1U << bits) - 1)) {
+		if (!set[slot].files) {
+			set[slot].files = files;
+			set[slot].task = task;
+			return true;
+		}
+		if (set[slot].files == files) {
+			task_lock(set[slot].task);
+			used = set[slot].task->files == files;
+			task_unlock(set[slot].task);
+			if (!used) {
+				// possibly another table at the same address
+				set[slot].task = task;
+			}
+			return !used;
+		}
+	}
+}
+
+/*
+ * Takes references to all threads and keeps only the first thread found
+ * using each fd table (OFS_MODE_DEDUP). Falls back to the thread group
+ * leaders if memory for the set of fd tables cannot be allocated.
+ */
+static unsigned int ofs_collect_threads(struct task_struct **tasks,
+		unsigned int capacity) {
+	struct task_struct *process;
+	struct task_struct *task;
+	struct ofs_files_slot *set;
+	struct files_struct *files;
+	unsigned int bits = ilog2(roundup_pow_of_two(capacity * 2));
+	unsigned int count = 0;
+
+	if (!(set = vzalloc(sizeof(*set) << bits))) {
+		return 0;
+	}
+
+	rcu_read_lock();
+	for_each_process_thread(process, task) {
+		if (count == capacity) {
+			break;
+		}
+		task_lock(task);
+		files = task->files;
+		task_unlock(task);
+		// the pointer is only compared, the table may go away
+		if (files && ofs_add_files(set, bits, files, task)) {
+			get_task_struct(task);
+			tasks[count++] = task;
+		}
+	}
+	rcu_read_unlock();
+	vfree(set);
+	return count;
+}
+
+/*
+ * Takes references to all tasks (or all threads with distinct fd tables if
+ * dedup is set). Tasks created after counting beyond some slack are not
+ * searched.
+ *
+ * Returns the number of tasks, 0 only if no memory was available (the
+ * current task always exists).
+ */
+static unsigned int ofs_collect_tasks(struct task_struct ***tasks,
+		bool dedup) {
+	struct task_struct *process;
+	struct task_struct *task;
+	unsigned int count = 0;
+	unsigned int capacity = 0;
+
+	rcu_read_lock();
+	if (dedup) {
+		for_each_process_thread(process, task) {
+			capacity++;
+		}
+	} else {
+		for_each_process(task) {
+			capacity++;
+		}
+	}
+	rcu_read_unlock();
+
+	capacity += 64;
+	if (!(*tasks = vmalloc(capacity * sizeof(**tasks)))) {
+		return 0;
+	}
+
+	if (dedup && (count = ofs_collect_threads(*tasks, capacity))) {
+		return count;
+	}
+
+	rcu_read_lock();
+	for_each_process(task) {
+		if (count == capacity) {
+			break;
+		}
+		get_task_struct(task);
+		(*tasks)[count++] = task;
+	}
+	rcu_read_unlock();
+	return count;
+}
+
+static void ofs_put_tasks(struct task_struct **tasks, unsigned int count) {
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		put_task_struct(tasks[i]);
+	}
+	vfree(tasks);
+}
+
+/*
+ * Searches all tasks without holding RCU across the task list: references
+ * to all tasks (or all threads with distinct fd tables in OFS_MODE_DEDUP)
+ * are collected first, the scan reschedules between tasks.
+ *
+ * Returns false if no memory was available for the references (nothing
+ * has been searched, the caller walks the task list under RCU instead).
+ */
+static bool ofs_search_all_collected(struct ofs_scan *scan) {
+	struct task_struct **tasks;
+	unsigned int task_count = ofs_collect_tasks(&tasks,
+			scan->seen != NULL);
+	unsigned int i;
+	unsigned int fd;
+
+	if (!task_count) {
+		return false;
+	}
+
+	for (i = 0; i < task_count && ofs_scan_room(scan); i++) {
+		fd = 0;
+		ofs_search_task(scan, tasks[i], &fd);
+		cond_resched();
+	}
+	ofs_put_tasks(tasks, task_count);
+	return true;
+}
+
+/*
+ * Returns whether the root of the current task is the root of the kernel
+ * workers (init_fs). Names are built by d_path() relative to the root of
+ * the task building them, so only then do the workers of a parallel scan
+ * build the names the caller would see.
+ */
+static bool ofs_worker_root(void) {
+	struct path root;
+	struct path worker_root;
+	bool same;
+
+	get_fs_root(current->fs, &root);
+	get_fs_root(init_task.fs, &worker_root);
+	same = path_equal(&root, &worker_root);
+	path_put(&worker_root);
+	path_put(&root);
+	return same;
+}
+
+/*
+ * Searches all tasks with ofs_workers workers of the scan workqueue and
+ * merges their results into scan. Falls back to a sequential scan if
+ * memory for the workers cannot be allocated or if the caller's root is not
+ * the root of the workers (e.g. after a chroot() since OFS_MODE_PARALLEL has
+ * been set).
+ */
+static void ofs_search_all_parallel(struct ofs_scan *scan) {
+	struct ofs_parallel_scan parallel;
+	struct ofs_scan_worker *workers;
+	unsigned int worker_count = clamp_t(unsigned int, READ_ONCE(ofs_workers),
+			1, OFS_MAX_WORKERS);
+	unsigned int started = 0;
+	unsigned int i;
+	unsigned int count;
+
+	if (!ofs_worker_root()) {
+		ofs_search_all(scan);
+		return;
+	}
+
+	if (!(workers = kcalloc(worker_count, sizeof(*workers), GFP_KERNEL))) {
+		ofs_search_all(scan);
+		return;
+	}
+
+	if (!(parallel.task_count = ofs_collect_tasks(&parallel.tasks,
+					scan->seen != NULL))) {
+		kfree(workers);
+		ofs_search_all(scan);
+		return;
+	}
+	atomic_set(&parallel.next_task, 0);
+	atomic_set(&parallel.found, 0);
+	parallel.limit = scan->limit;
+
+	for (i = 0; i < worker_count; i++) {
+		if (!(workers[i].scan.results = kmalloc(scan->limit
+						* sizeof(struct ofs_result),
+						GFP_KERNEL))) {
+			break;
+		}
+		workers[i].scan.query = scan->query;
+		workers[i].scan.limit = scan->limit;
+		workers[i].scan.lowlat = scan->lowlat;
+		workers[i].scan.stats = &workers[i].stats;
+		// without a set of its own the worker does not collapse fds
+		workers[i].scan.seen = scan->seen ? kzalloc(
+				sizeof(struct ofs_seen_file) << OFS_SEEN_BITS,
+				GFP_KERNEL) : NULL;
+		workers[i].parallel = &parallel;
+		INIT_WORK(&workers[i].work, &ofs_scan_worker_fn);
+		queue_work(ofs_scan_wq_, &workers[i].work);
+		started++;
+	}
+	if (!started) {
+		// no memory for any worker -> search in the caller's context
+		ofs_put_tasks(parallel.tasks, parallel.task_count);
+		kfree(workers);
+		ofs_search_all(scan);
+		return;
+	}
+
+	// merge the results of all workers
+	for (i = 0; i < started; i++) {
+		flush_work(&workers[i].work);
+		count = min(workers[i].scan.count, scan->limit - scan->count);
+		memcpy(&scan->results[scan->count], workers[i].scan.results,
+				count * sizeof(struct ofs_result));
+		scan->count += count;
+		kfree(workers[i].scan.results);
+		kfree(workers[i].scan.seen);
+
+		ofs_stats_add(scan->stats, &workers[i].stats);
+	}
+
+	ofs_put_tasks(parallel.tasks, parallel.task_count);
+	kfree(workers);
+}
+
+/**
+ * An open fd in the open file index (OFS_MODE_INDEX).
+ *
+ * No reference to the open file (or the fd table) is held, so an fd whose
+ * close has been missed by the probes does not pin the file and its mount.
+ * Entries are only candidates: a search checks them against the live fd
+ * table (see ofs_index_search()).
+ *
+ * Entries are not modified once published (except gen): an fd that changed
+ * is replaced by a new entry, so lookups under RCU never follow a node that
+ * moved to another bucket.
+ */
+struct ofs_index_entry {
+	/* The nodes of the hash tables (OFS_INDEX_BY_*) */
+	struct hlist_node nodes[OFS_INDEX_TABLES];
+
+	/* The node of the table by fd table and fd (ofs_index_fds_) */
+	struct hlist_node fd_node;
+
+	/* The keys of the hash tables: inode (only compared), uid of the
+	 * process and owner */
+	unsigned long keys[OFS_INDEX_TABLES];
+
+	/* The fd table (only compared, never dereferenced) */
+	struct files_struct *files;
+
+	/* The fd */
+	unsigned int fd;
+
+	/* The identity of the inode (its address may be reused once the
+	 * inode has been freed) */
+	dev_t dev;
+	unsigned long ino;
+
+	/* The thread using the fd table (initial pid namespace) */
+	pid_t tid;
+
+	/* The pid of the process */
+	pid_t pid;
+
+	/* The generation of the consistency check that created or last
+	 * confirmed the entry (protected by the lock of its fd bucket) */
+	unsigned long gen;
+
+	struct rcu_head rcu;
+};
+
+/**
+ * A candidate of an index lookup, checked against the live fd table after
+ * the RCU read-side section has ended.
+ */
+struct ofs_index_hit {
+	struct files_struct *files;
+	unsigned int fd;
+	dev_t dev;
+	unsigned long ino;
+	pid_t tid;
+	pid_t pid;
+	uid_t uid;
+};
+
+// the hash tables of the open file index by key, one lock per bucket for
+// writers; lookups are RCU-protected (entries are freed via RCU)
+static struct hlist_head ofs_index_[OFS_INDEX_TABLES][1 << OFS_INDEX_BITS];
+static spinlock_t ofs_index_locks_[OFS_INDEX_TABLES][1 << OFS_INDEX_BITS];
+
+// the hash table by fd table and fd, one lock per bucket; an entry is
+// (un)linked with the lock of its fd bucket held, which is taken before the
+// locks of its buckets by key
+static struct hlist_head ofs_index_fds_[1 << OFS_INDEX_BITS];
+static spinlock_t ofs_index_fd_locks_[1 << OFS_INDEX_BITS];
+
+// serializes consistency checks (they use ofs_index_gen_)
+static DEFINE_MUTEX(ofs_index_sync_lock_);
+
+// the generation of the current consistency check
+static unsigned long ofs_index_gen_;
+
+// serializes (un)registering the probes
+static DEFINE_MUTEX(ofs_probes_lock_);
+
+// the number of users of the probes (the index and subscriptions)
+static unsigned int ofs_probes_users_;
+
+// the subscriptions fed by the probes (RCU, written under the lock)
+static LIST_HEAD(ofs_subscribers_);
+static DEFINE_SPINLOCK(ofs_subscribers_lock_);
+
+// whether the probes maintain the index
+static bool ofs_index_active_;
+
+// whether the index has been seeded
+static bool ofs_index_ready_;
+
+// the number of events lost because no memory was available
+static atomic_long_t ofs_index_lost_ = ATOMIC_LONG_INIT(0);
+
+static inline unsigned int ofs_index_fd_hash(struct files_struct *files,
+		unsigned int fd) {
+	return hash_long((unsigned long) files + fd, OFS_INDEX_BITS);
+}
+
+static inline struct ofs_index_entry *ofs_index_entry(struct hlist_node *node,
+		unsigned int table) {
+	return container_of(node - table, struct ofs_index_entry, nodes[0]);
+}
+
+/*
+ * Returns the entry of an fd of the fd table files (or NULL).
+ * Called with the lock of the fd bucket held.
+ */
+static struct ofs_index_entry *ofs_index_lookup(struct files_struct *files,
+		unsigned int fd) {
+	struct ofs_index_entry *entry;
+
+	hlist_for_each_entry(entry, &ofs_index_fds_[ofs_index_fd_hash(files,
+				fd)], fd_node) {
+		if (entry->files == files && entry->fd == fd) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Returns whether an open file refers to the inode of an entry.
+ */
+static inline bool ofs_index_same_inode(const struct ofs_index_entry *entry,
+		struct file *file) {
+	struct inode *inode = file_inode(file);
+
+	return entry->keys[OFS_INDEX_BY_INODE] == (unsigned long) inode
+		&& entry->ino == inode->i_ino
+		&& entry->dev == inode->i_sb->s_dev;
+}
+
+/*
+ * Returns whether an entry describes an open file of a process.
+ */
+static inline bool ofs_index_matches(const struct ofs_index_entry *entry,
+		struct file *file, pid_t pid, uid_t uid) {
+	return ofs_index_same_inode(entry, file) && entry->pid == pid
+		&& entry->keys[OFS_INDEX_BY_UID] == uid
+		&& entry->keys[OFS_INDEX_BY_OWNER]
+			== file_inode(file)->i_uid.val;
+}
+
+/*
+ * Publishes a new entry. Called with the lock of its fd bucket held.
+ */
+static void ofs_index_link(struct ofs_index_entry *entry) {
+	unsigned int table;
+	unsigned int bucket;
+
+	for (table = 0; table < OFS_INDEX_TABLES; table++) {
+		bucket = hash_long(entry->keys[table], OFS_INDEX_BITS);
+		spin_lock(&ofs_index_locks_[table][bucket]);
+		hlist_add_head_rcu(&entry->nodes[table],
+				&ofs_index_[table][bucket]);
+		spin_unlock(&ofs_index_locks_[table][bucket]);
+	}
+	hlist_add_head_rcu(&entry->fd_node, &ofs_index_fds_[ofs_index_fd_hash(
+				entry->files, entry->fd)]);
+}
+
+/*
+ * Removes an entry from the index, it is freed once no lookup can see it
+ * anymore. Called with the lock of its fd bucket held.
+ */
+static void ofs_index_delete(struct ofs_index_entry *entry) {
+	unsigned int table;
+	unsigned int bucket;
+
+	hlist_del_rcu(&entry->fd_node);
+	for (table = 0; table < OFS_INDEX_TABLES; table++) {
+		bucket = hash_long(entry->keys[table], OFS_INDEX_BITS);
+		spin_lock(&ofs_index_locks_[table][bucket]);
+		hlist_del_rcu(&entry->nodes[table]);
+		spin_unlock(&ofs_index_locks_[table][bucket]);
+	}
+	kfree_rcu(entry, rcu);
+}
+
+/*
+ * Adds an fd of the fd table files to the index (or replaces the entry of
+ * the fd, e.g. after a missed close). Called with the lock of the fd bucket
+ * held (often from a probe), so memory is allocated without sleeping.
+ *
+ * Returns the entry of the fd or NULL if no memory was available.
+ */
+static struct ofs_index_entry *ofs_index_insert(struct files_struct *files,
+		unsigned int fd, struct file *file, pid_t tid, pid_t pid,
+		uid_t uid) {
+	struct ofs_index_entry *old = ofs_index_lookup(files, fd);
+	struct ofs_index_entry *entry;
+	struct inode *inode = file_inode(file);
+
+	if (old && ofs_index_matches(old, file, pid, uid)) {
+		old->gen = READ_ONCE(ofs_index_gen_);
+		return old;
+	}
+
+	if (!(entry = kmalloc(sizeof(*entry), GFP_ATOMIC))) {
+		atomic_long_inc(&ofs_index_lost_);
+		return NULL;
+	}
+	entry->files = files;
+	entry->fd = fd;
+	entry->dev = inode->i_sb->s_dev;
+	entry->ino = inode->i_ino;
+	entry->tid = tid;
+	entry->pid = pid;
+	entry->gen = READ_ONCE(ofs_index_gen_);
+	entry->keys[OFS_INDEX_BY_INODE] = (unsigned long) inode;
+	entry->keys[OFS_INDEX_BY_UID] = uid;
+	entry->keys[OFS_INDEX_BY_OWNER] = inode->i_uid.val;
+
+	if (old) {
+		ofs_index_delete(old);
+	}
+	ofs_index_link(entry);
+	return entry;
+}
+
+static void ofs_index_add(struct files_struct *files, unsigned int fd,
+		struct file *file, pid_t tid, pid_t pid, uid_t uid) {
+	unsigned int bucket = ofs_index_fd_hash(files, fd);
+
+	spin_lock(&ofs_index_fd_locks_[bucket]);
+	ofs_index_insert(files, fd, file, tid, pid, uid);
+	spin_unlock(&ofs_index_fd_locks_[bucket]);
+}
+
+/*
+ * Adds all fds of the fd table of a task, e.g. a table copied by dup_fd()
+ * without fd_install().
+ */
+static void ofs_index_add_table(struct task_struct *task,
+		struct files_struct *files) {
+	struct fdtable *fdt;
+	struct file *file;
+	unsigned int fd;
+	uid_t uid;
+
+	rcu_read_lock();
+	uid = rcu_dereference(task->cred)->uid.val;
+	fdt = files_fdtable(files);
+	for (fd = 0; fd < fdt->max_fds; fd++) {
+		if (fd_is_open(fd, fdt)
+				&& (file = rcu_dereference_raw(fdt->fd[fd]))) {
+			ofs_index_add(files, fd, file, task->pid, task->tgid,
+					uid);
+		}
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Removes the entry of an fd of the fd table files (if any).
+ */
+static void ofs_index_remove(struct files_struct *files, unsigned int fd) {
+	struct ofs_index_entry *entry;
+	unsigned int bucket = ofs_index_fd_hash(files, fd);
+
+	spin_lock(&ofs_index_fd_locks_[bucket]);
+	if ((entry = ofs_index_lookup(files, fd))) {
+		ofs_index_delete(entry);
+	}
+	spin_unlock(&ofs_index_fd_locks_[bucket]);
+}
+
+/*
+ * Removes the entries of the open fds of the fd table files that are about
+ * to be closed: all of them or only those marked close-on-exec.
+ */
+static void ofs_index_remove_table(struct files_struct *files, bool cloexec) {
+	struct fdtable *fdt;
+	unsigned int fd;
+
+	rcu_read_lock();
+	fdt = files_fdtable(files);
+	for (fd = 0; fd < fdt->max_fds; fd++) {
+		if (fd_is_open(fd, fdt)
+				&& (!cloexec || close_on_exec(fd, fdt))) {
+			ofs_index_remove(files, fd);
+		}
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Removes the entry of a candidate that did not pass the check against the
+ * live fd table (unless the fd has been indexed again in the meantime).
+ */
+static void ofs_index_forget(const struct ofs_index_hit *hit) {
+	struct ofs_index_entry *entry;
+	unsigned int bucket = ofs_index_fd_hash(hit->files, hit->fd);
+
+	spin_lock(&ofs_index_fd_locks_[bucket]);
+	if ((entry = ofs_index_lookup(hit->files, hit->fd))
+			&& entry->tid == hit->tid && entry->dev == hit->dev
+			&& entry->ino == hit->ino) {
+		ofs_index_delete(entry);
+	}
+	spin_unlock(&ofs_index_fd_locks_[bucket]);
+}
+
+/*
+ * Adds an open or close event of the current task to a subscription if it
+ * passes the subscription's filter. Never waits for the reader: if the ring
+ * of this CPU is full the event is counted as lost.
+ *
+ * Called from a probe (with preemption disabled), so this CPU is the only
+ * producer of its ring.
+ */
+static void ofs_subscription_event(struct ofs_subscription *sub,
+		unsigned int type, int fd, struct file *file, uid_t uid) {
+	const struct ofs_query *query = sub->query;
+	struct ofs_event_ring *ring = &sub->rings[smp_processor_id()];
+	unsigned int head = ring->head;
+	struct ofs_result result;
+	struct ofs_event *event;
+	struct ofs_scan scan = {
+		.query = query,
+		.results = &result,
+		.limit = 1,
+	};
+	pid_t tgid = query->pid_ns ? task_tgid_nr_ns(current, query->pid_ns)
+		: current->tgid;
+
+	if (query->pid && query->pid != tgid) {
+		return;
+	}
+	if (!ofs_task_in_scope(query, current)) {
+		return;
+	}
+	// the nsproxy of the current task does not change under it
+	if (query->filter->match_task && !query->filter->match_task(current,
+				uid, (union ofs_filter_arg *) &query->arg)) {
+		return;
+	}
+	ofs_filter_result(&scan, tgid, uid, file);
+	if (!scan.count) {
+		return;
+	}
+
+	if (head - smp_load_acquire(&ring->tail) >= OFS_EVENT_RING_SIZE) {
+		WRITE_ONCE(ring->lost, ring->lost + 1);
+		return;
+	}
+	event = &ring->events[head & (OFS_EVENT_RING_SIZE - 1)];
+	event->type = type;
+	event->fd = fd;
+	event->cpu = smp_processor_id();
+	event->time_ns = ktime_get_ns();
+	event->lost = 0;
+	event->result = result;
+
+	// publish the event before the new head
+	smp_store_release(&ring->head, head + 1);
+	if (wq_has_sleeper(sub->wait)) {
+		wake_up_interruptible(sub->wait);
+	}
+}
+
+static void ofs_notify(unsigned int type, int fd, struct file *file) {
+	struct ofs_subscription *sub;
+	uid_t uid;
+
+	if (list_empty(&ofs_subscribers_)) {
+		return;
+	}
+
+	uid = current_uid().val;
+	rcu_read_lock();
+	list_for_each_entry_rcu(sub, &ofs_subscribers_, list) {
+		ofs_subscription_event(sub, type, fd, file, uid);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Probes feeding the index and the subscriptions. jprobe handlers get the
+ * arguments of the probed function and must return via jprobe_return().
+ * They run with preemption disabled.
+ */
+static void ofs_probe_fd_install(unsigned int fd, struct file *file) {
+	struct files_struct *files = current->files;
+
+	if (READ_ONCE(ofs_index_active_) && files) {
+		ofs_index_add(files, fd, file, current->pid, current->tgid,
+				current_uid().val);
+	}
+	ofs_notify(OFS_EVENT_OPEN, fd, file);
+	jprobe_return();
+}
+
+// every fd is closed via filp_close() (close(), dup2(), exit, exec)
+static int ofs_probe_filp_close(struct file *file, fl_owner_t id) {
+	// files opened by the kernel have no fd table
+	if (id) {
+		ofs_notify(OFS_EVENT_CLOSE, -1, file);
+	}
+	jprobe_return();
+	return 0;
+}
+
+/*
+ * close() of an fd. filp_close() does not know the fd, so the index is
+ * maintained by the callers of filp_close() that do: close(), exec and the
+ * release of an fd table. dup2() onto an open fd replaces the entry via
+ * sys_dup3().
+ */
+static int ofs_probe_close_fd(struct files_struct *files, unsigned int fd) {
+	if (READ_ONCE(ofs_index_active_)) {
+		ofs_index_remove(files, fd);
+	}
+	jprobe_return();
+	return 0;
+}
+
+// exec closes the fds marked close-on-exec
+static void ofs_probe_do_close_on_exec(struct files_struct *files) {
+	if (READ_ONCE(ofs_index_active_)) {
+		ofs_index_remove_table(files, true);
+	}
+	jprobe_return();
+}
+
+/*
+ * The last reference to an fd table (exit, exec or unshare of the last
+ * user) closes all its fds. Two references dropped concurrently are missed;
+ * the entries are removed by the next search finding them or by
+ * OFS_INDEX_CHECK.
+ */
+static void ofs_probe_put_files_struct(struct files_struct *files) {
+	if (READ_ONCE(ofs_index_active_) && atomic_read(&files->count) == 1) {
+		ofs_index_remove_table(files, false);
+	}
+	jprobe_return();
+}
+
+// dup_fd() copies the fd table of a new task without fd_install()
+static void ofs_probe_wake_up_new_task(struct task_struct *task) {
+	struct files_struct *files = task->files;
+
+	// threads (and CLONE_FILES) share the fd table of the caller
+	if (READ_ONCE(ofs_index_active_) && files && files != current->files) {
+		ofs_index_add_table(task, files);
+	}
+	jprobe_return();
+}
+
+// dup2() and dup3() install the new fd without fd_install()
+static int ofs_probe_dup3_ret(struct kretprobe_instance *instance,
+		struct pt_regs *regs) {
+	long fd = regs_return_value(regs);
+	struct files_struct *files = current->files;
+	struct file *file;
+
+	if (fd < 0 || !files) {
+		return 0;
+	}
+	rcu_read_lock();
+	if ((file = fcheck_files(files, fd))) {
+		if (READ_ONCE(ofs_index_active_)) {
+			ofs_index_add(files, fd, file, current->pid,
+					current->tgid, current_uid().val);
+		}
+		ofs_notify(OFS_EVENT_OPEN, fd, file);
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+// remembers the fd table of the current task before it may be replaced
+static int ofs_probe_unshare_entry(struct kretprobe_instance *instance,
+		struct pt_regs *regs) {
+	*(struct files_struct **) instance->data = current->files;
+	return 0;
+}
+
+/*
+ * unshare(CLONE_FILES) and exec() of a multithreaded process (via
+ * unshare_files()) replace the fd table of the current task by a copy made
+ * by dup_fd() without fd_install().
+ */
+static int ofs_probe_unshare_ret(struct kretprobe_instance *instance,
+		struct pt_regs *regs) {
+	struct files_struct *files = current->files;
+
+	if (READ_ONCE(ofs_index_active_) && files
+			&& files != *(struct files_struct **) instance->data) {
+		ofs_index_add_table(current, files);
+	}
+	return 0;
+}
+
+static struct jprobe ofs_jprobes_[] = {
+	{
+		.entry = ofs_probe_fd_install,
+		.kp = { .symbol_name = "fd_install" }
+	}, {
+		.entry = ofs_probe_filp_close,
+		.kp = { .symbol_name = "filp_close" }
+	}, {
+		.entry = ofs_probe_close_fd,
+		.kp = { .symbol_name = "__close_fd" }
+	}, {
+		.entry = ofs_probe_do_close_on_exec,
+		.kp = { .symbol_name = "do_close_on_exec" }
+	}, {
+		.entry = ofs_probe_put_files_struct,
+		.kp = { .symbol_name = "put_files_struct" }
+	}, {
+		.entry = ofs_probe_wake_up_new_task,
+		.kp = { .symbol_name = "wake_up_new_task" }
+	}
+};
+
+static struct kretprobe ofs_kretprobes_[] = {
+	{
+		.handler = ofs_probe_dup3_ret,
+		.kp = { .symbol_name = "sys_dup3" }
+	}, {
+		.entry_handler = ofs_probe_unshare_entry,
+		.handler = ofs_probe_unshare_ret,
+		.data_size = sizeof(struct files_struct *),
+		.kp = { .symbol_name = "unshare_files" }
+	}, {
+		.entry_handler = ofs_probe_unshare_entry,
+		.handler = ofs_probe_unshare_ret,
+		.data_size = sizeof(struct files_struct *),
+		.kp = { .symbol_name = "sys_unshare" }
+	}
+};
+
+/*
+ * Registers the probes for the first user (the index or a subscription).
+ * The probes cost every open() and close() on the system, so they are only
+ * registered while they are used.
+ */
+static int ofs_probes_get(void) {
+	unsigned int i;
+	unsigned int j = 0;
+	int err = 0;
+
+	mutex_lock(&ofs_probes_lock_);
+	if (ofs_probes_users_++) {
+		goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ofs_jprobes_); i++) {
+		if ((err = register_jprobe(&ofs_jprobes_[i]))) {
+			printk(KERN_ERR "openFileSearch: Failed to probe %s " \
+					"(%d)\n", ofs_jprobes_[i].kp.symbol_name,
+					err);
+			goto unregister;
+		}
+	}
+	for (j = 0; j < ARRAY_SIZE(ofs_kretprobes_); j++) {
+		if ((err = register_kretprobe(&ofs_kretprobes_[j]))) {
+			printk(KERN_ERR "openFileSearch: Failed to probe %s " \
+					"(%d)\n",
+					ofs_kretprobes_[j].kp.symbol_name, err);
+			goto unregister;
+		}
+	}
+	goto out;
+
+unregister:
+	while (j--) {
+		unregister_kretprobe(&ofs_kretprobes_[j]);
+	}
+	while (i--) {
+		unregister_jprobe(&ofs_jprobes_[i]);
+	}
+	ofs_probes_users_--;
+out:
+	mutex_unlock(&ofs_probes_lock_);
+	return err;
+}
+
+// waits until no handler is running if the probes are unregistered
+static void ofs_probes_put(void) {
+	unsigned int i;
+
+	mutex_lock(&ofs_probes_lock_);
+	if (!--ofs_probes_users_) {
+		for (i = 0; i < ARRAY_SIZE(ofs_kretprobes_); i++) {
+			unregister_kretprobe(&ofs_kretprobes_[i]);
+		}
+		for (i = 0; i < ARRAY_SIZE(ofs_jprobes_); i++) {
+			unregister_jprobe(&ofs_jprobes_[i]);
+		}
+	}
+	mutex_unlock(&ofs_probes_lock_);
+}
+
+/*
+ * Compares the index entries of the fd table of a task with the fd table.
+ */
+static void ofs_index_sync_task(struct ofs_index_check *check,
+		struct task_struct *task, bool repair) {
+	struct ofs_index_entry *entry;
+	struct files_struct *files;
+	struct fdtable *fdt;
+	struct file *file;
+	unsigned int bucket;
+	unsigned int fd;
+	uid_t uid;
+
+	rcu_read_lock();
+	uid = rcu_dereference(task->cred)->uid.val;
+	rcu_read_unlock();
+
+	task_lock(task);
+	if (!(files = task->files)) {
+		task_unlock(task);
+		return;
+	}
+
+	rcu_read_lock();
+	fdt = files_fdtable(files);
+	for (fd = 0; fd < fdt->max_fds; fd++) {
+		if (!fd_is_open(fd, fdt)
+				|| !(file = rcu_dereference_raw(fdt->fd[fd]))) {
+			continue;
+		}
+		check->scanned++;
+
+		bucket = ofs_index_fd_hash(files, fd);
+		spin_lock(&ofs_index_fd_locks_[bucket]);
+		entry = ofs_index_lookup(files, fd);
+		if (entry && ofs_index_matches(entry, file, task->tgid, uid)) {
+			entry->gen = ofs_index_gen_;
+		} else {
+			if (entry) {
+				// e.g. setuid() or chown() after the open()
+				check->mismatched++;
+				// reported once, not also as stale
+				entry->gen = ofs_index_gen_;
+			} else {
+				check->missing++;
+			}
+			// replaces an outdated entry
+			if (repair) {
+				ofs_index_insert(files, fd, file, task->pid,
+						task->tgid, uid);
+			}
+		}
+		spin_unlock(&ofs_index_fd_locks_[bucket]);
+	}
+	rcu_read_unlock();
+	task_unlock(task);
+}
+
+/*
+ * Compares the index with a full scan of all fd tables and repairs the
+ * differences if repair is set (which also seeds an empty index).
+ *
+ * fd tables may change during the scan, so differences found on a busy
+ * system do not necessarily mean that the index is inconsistent. Entries
+ * created during the check are not considered stale.
+ *
+ * Returns 0 or -ENOMEM if the tasks could not be collected (without a scan
+ * every entry would look stale).
+ */
+static long ofs_index_sync(struct ofs_index_check *check, bool repair) {
+	struct task_struct **tasks;
+	unsigned int task_count;
+	struct ofs_index_entry *entry;
+	struct hlist_node *next;
+	unsigned int bucket;
+	unsigned int i;
+
+	mutex_lock(&ofs_index_sync_lock_);
+	WRITE_ONCE(ofs_index_gen_, ofs_index_gen_ + 1);
+	// probe handlers run with preemption disabled: once this returns, no
+	// entry is created with the previous generation anymore
+	synchronize_sched();
+
+	// every thread with an fd table of its own (unshare(CLONE_FILES))
+	if (!(task_count = ofs_collect_tasks(&tasks, true))) {
+		mutex_unlock(&ofs_index_sync_lock_);
+		return -ENOMEM;
+	}
+	for (i = 0; i < task_count; i++) {
+		ofs_index_sync_task(check, tasks[i], repair);
+		cond_resched();
+	}
+	ofs_put_tasks(tasks, task_count);
+
+	// fds of the index that have not been found by the scan are stale
+	for (bucket = 0; bucket < (1 << OFS_INDEX_BITS); bucket++) {
+		spin_lock(&ofs_index_fd_locks_[bucket]);
+		hlist_for_each_entry_safe(entry, next, &ofs_index_fds_[bucket],
+				fd_node) {
+			if (entry->gen != ofs_index_gen_) {
+				check->stale++;
+				if (repair) {
+					ofs_index_delete(entry);
+					continue;
+				}
+			}
+			check->indexed++;
+		}
+		spin_unlock(&ofs_index_fd_locks_[bucket]);
+		cond_resched();
+	}
+
+	check->lost = atomic_long_read(&ofs_index_lost_);
+	for (i = 0; i < ARRAY_SIZE(ofs_jprobes_); i++) {
+		check->lost += ofs_jprobes_[i].kp.nmissed;
+	}
+	for (i = 0; i < ARRAY_SIZE(ofs_kretprobes_); i++) {
+		check->lost += ofs_kretprobes_[i].nmissed
+			+ ofs_kretprobes_[i].kp.nmissed;
+	}
+	mutex_unlock(&ofs_index_sync_lock_);
+	return 0;
+}
+
+/*
+ * Returns the open file of an index candidate (with a reference taken) if
+ * the fd still refers to the indexed inode in the live fd table, or NULL.
+ *
+ * The fd table is reached via the thread that installed the fd or, if it
+ * exited in the meantime, via the process.
+ */
+static struct file *ofs_index_get_file(const struct ofs_index_hit *hit) {
+	struct task_struct *task;
+	struct file *file = NULL;
+	pid_t nr = hit->tid;
+
+	rcu_read_lock();
+	for (;;) {
+		task = pid_task(find_pid_ns(nr, &init_pid_ns), PIDTYPE_PID);
+		if (task) {
+			// the fd table is only dereferenced while in use
+			task_lock(task);
+			if (task->files == hit->files) {
+				file = fcheck_files(hit->files, hit->fd);
+				if (file && (file_inode(file)->i_ino != hit->ino
+						|| file_inode(file)->i_sb->s_dev
+							!= hit->dev
+						|| !get_file_rcu(file))) {
+					file = NULL;
+				}
+				task_unlock(task);
+				break;
+			}
+			task_unlock(task);
+		}
+		if (nr == hit->pid) {
+			break;
+		}
+		nr = hit->pid;
+	}
+	rcu_read_unlock();
+	return file;
+}
+
+/*
+ * Serves a search from the open file index. Returns false if the filter
+ * cannot be served from the index (the caller falls back to a full scan).
+ *
+ * Matching entries are only candidates: they are copied under RCU (no lock
+ * is taken) and checked against the live fd tables afterwards. Entries
+ * failing the check (e.g. a close missed by the probes) are removed. The
+ * order of the results is not defined.
+ */
+static bool ofs_index_search(struct ofs_scan *scan) {
+	const struct ofs_filter *filter = scan->query->filter;
+	struct ofs_index_hit *hits;
+	struct ofs_index_hit *hit;
+	struct ofs_index_entry *entry;
+	struct hlist_node *node;
+	struct file *file;
+	unsigned long key;
+	unsigned int hit_count = 0;
+	unsigned int i;
+	int table;
+
+	// the index has no notion of scopes
+	if (scan->query->scope || !filter->index_key
+			|| (table = filter->index_key(
+					(union ofs_filter_arg *)
+					&scan->query->arg, &key)) < 0) {
+		return false;
+	}
+
+	if (!(hits = kmalloc_array(scan->limit, sizeof(*hits), GFP_KERNEL))) {
+		return false;
+	}
+
+	rcu_read_lock();
+	__hlist_for_each_rcu(node, &ofs_index_[table][hash_long(key,
+				OFS_INDEX_BITS)]) {
+		entry = ofs_index_entry(node, table);
+		if (entry->keys[table] != key) {
+			continue;
+		}
+		// one result per fd
+		hit = &hits[hit_count];
+		hit->files = entry->files;
+		hit->fd = entry->fd;
+		hit->dev = entry->dev;
+		hit->ino = entry->ino;
+		hit->tid = entry->tid;
+		hit->pid = entry->pid;
+		hit->uid = entry->keys[OFS_INDEX_BY_UID];
+		if (++hit_count == scan->limit) {
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	for (i = 0; i < hit_count; i++) {
+		if (!(file = ofs_index_get_file(&hits[i]))) {
+			ofs_index_forget(&hits[i]);
+			continue;
+		}
+		ofs_filter_result(scan, ofs_pid_in_ns(scan->query, hits[i].pid),
+				hits[i].uid, file);
+		fput(file);
+	}
+	kfree(hits);
+	return true;
+}
+
+// removes all entries, called once the probes have been unregistered
+static void ofs_index_clear(void) {
+	struct ofs_index_entry *entry;
+	struct hlist_node *next;
+	unsigned int bucket;
+
+	for (bucket = 0; bucket < (1 << OFS_INDEX_BITS); bucket++) {
+		spin_lock(&ofs_index_fd_locks_[bucket]);
+		hlist_for_each_entry_safe(entry, next, &ofs_index_fds_[bucket],
+				fd_node) {
+			ofs_index_delete(entry);
+		}
+		spin_unlock(&ofs_index_fd_locks_[bucket]);
+	}
+}
+
+/*
+ * Registers the probes and seeds the index with a full scan. Probes are
+ * registered first so no fd installed during the seeding is lost.
+ */
+static int ofs_index_init(void) {
+	struct ofs_index_check check;
+	unsigned int table;
+	unsigned int bucket;
+	int err;
+
+	for (bucket = 0; bucket < (1 << OFS_INDEX_BITS); bucket++) {
+		for (table = 0; table < OFS_INDEX_TABLES; table++) {
+			spin_lock_init(&ofs_index_locks_[table][bucket]);
+		}
+		spin_lock_init(&ofs_index_fd_locks_[bucket]);
+	}
+
+	ofs_index_active_ = 1;
+	if ((err = ofs_probes_get())) {
+		ofs_index_active_ = 0;
+		return err;
+	}
+
+	memset(&check, 0, sizeof(check));
+	if ((err = ofs_index_sync(&check, true))) {
+		ofs_index_active_ = 0;
+		ofs_probes_put();
+		ofs_index_clear();
+		return err;
+	}
+	ofs_index_ready_ = 1;
+
+	printk(KERN_INFO "openFileSearch: Indexed %llu open files\n",
+			check.indexed);
+	return 0;
+}
+
+static void ofs_index_exit(void) {
+	if (!ofs_index_active_) {
+		return;
+	}
+
+	// no subscription is left when the module is unloaded
+	ofs_index_active_ = 0;
+	ofs_probes_put();
+	ofs_index_clear();
+	ofs_index_ready_ = 0;
+}
+
+/*
+ * Returns the task the cursor points to (with a reference taken) or NULL if
+ * all tasks have been searched.
+ *
+ * Tasks are visited in the order of the task list (= order of creation). If
+ * the current task exited in the meantime the scan continues with the next
+ * task created after it.
+ *
+ * prev is the task searched last by the caller (with a reference held) or
+ * NULL. If it is still alive its successor is taken directly instead of
+ * walking the task list from the beginning.
+ *
+ * In OFS_MODE_DEDUP the tasks of the snapshot taken by the search ioctl are
+ * visited in order instead.
+ */
+static struct task_struct *ofs_cursor_task(struct ofs_session *session,
+		struct task_struct *prev) {
+	struct ofs_cursor *cursor = &session->cursor;
+	struct task_struct *task = NULL;
+	struct task_struct *candidate;
+
+	if (session->tasks) {
+		if (cursor->task_done) {
+			cursor->index++;
+			cursor->fd = 0;
+			cursor->task_done = 0;
+		}
+		if (cursor->index < session->task_count) {
+			task = session->tasks[cursor->index];
+			get_task_struct(task);
+		}
+		return task;
+	}
+
+	rcu_read_lock();
+	if (session->query.pid) {
+		candidate = pid_task(session->query.pid_ref, PIDTYPE_PID);
+		if (candidate && !cursor->task_done
+				&& candidate->start_time == cursor->start_time) {
+			task = candidate;
+		}
+	} else if (prev && cursor->task_done && pid_alive(prev)) {
+		// still on the task list -> its successor is valid under RCU
+		candidate = next_task(prev);
+		if (candidate != &init_task) {
+			cursor->pid = candidate->pid;
+			cursor->start_time = candidate->start_time;
+			cursor->fd = 0;
+			cursor->task_done = 0;
+			task = candidate;
+		}
+	} else {
+		for_each_process(candidate) {
+			if (candidate->pid == cursor->pid
+					&& candidate->start_time
+						== cursor->start_time) {
+				if (cursor->task_done) {
+					// continue with the next task
+					continue;
+				}
+				task = candidate;
+				break;
+			}
+			if (!cursor->pid
+					|| candidate->start_time
+						> cursor->start_time) {
+				// start with a new task
+				cursor->pid = candidate->pid;
+				cursor->start_time = candidate->start_time;
+				cursor->fd = 0;
+				cursor->task_done = 0;
+				task = candidate;
+				break;
+			}
+		}
+	}
+
+	if (task) {
+		get_task_struct(task);
+	}
+	rcu_read_unlock();
+	return task;
+}
+
+// the statistics of all scans since the module has been loaded
+// (protected by ofs_totals_lock_, shown in debugfs)
+static struct ofs_stats ofs_totals_;
+static unsigned long long ofs_total_scans_;
+static DEFINE_SPINLOCK(ofs_totals_lock_);
+
+static struct dentry *ofs_debugfs_;
+
+/*
+ * Starts a scan of the session (the whole scan of a search or a part of a
+ * streaming search). Returns the start time; before receives the
+ * statistics of the search so far.
+ */
+static u64 ofs_scan_begin(struct ofs_session *session,
+		struct ofs_stats *before) {
+	*before = session->stats;
+	trace_ofs_scan_start(session, session->mode, session->scan.limit);
+	return ktime_get_ns();
+}
+
+/*
+ * Ends a scan started by ofs_scan_begin(): accounts its time and adds its
+ * counters to the totals.
+ */
+static void ofs_scan_end(struct ofs_session *session,
+		const struct ofs_stats *before, u64 started_at) {
+	struct ofs_stats *stats = &session->stats;
+	struct ofs_stats scan_stats;
+
+	stats->scan_ns += ktime_get_ns() - started_at;
+
+	// the counters of this scan only
+	scan_stats.max_lock_ns = stats->max_lock_ns;
+	scan_stats.lock_sections = stats->lock_sections
+		- before->lock_sections;
+	scan_stats.tasks = stats->tasks - before->tasks;
+	scan_stats.fds = stats->fds - before->fds;
+	scan_stats.d_path_calls = stats->d_path_calls - before->d_path_calls;
+	scan_stats.rejected = stats->rejected - before->rejected;
+	scan_stats.truncated_names = stats->truncated_names
+		- before->truncated_names;
+	scan_stats.scan_ns = stats->scan_ns - before->scan_ns;
+	trace_ofs_scan_end(session, session->scan.count, &scan_stats);
+
+	spin_lock(&ofs_totals_lock_);
+	ofs_total_scans_++;
+	ofs_stats_add(&ofs_totals_, &scan_stats);
+	spin_unlock(&ofs_totals_lock_);
+}
+
+static int ofs_debugfs_stats_show(struct seq_file *m, void *data) {
+	struct ofs_stats totals;
+	unsigned long long scans;
+
+	spin_lock(&ofs_totals_lock_);
+	totals = ofs_totals_;
+	scans = ofs_total_scans_;
+	spin_unlock(&ofs_totals_lock_);
+
+	seq_printf(m, "scans: %llu\n", scans);
+	seq_printf(m, "tasks: %llu\n", totals.tasks);
+	seq_printf(m, "fds: %llu\n", totals.fds);
+	seq_printf(m, "d_path_calls: %llu\n", totals.d_path_calls);
+	seq_printf(m, "rejected: %llu\n", totals.rejected);
+	seq_printf(m, "truncated_names: %llu\n", totals.truncated_names);
+	seq_printf(m, "scan_ns: %llu\n", totals.scan_ns);
+	seq_printf(m, "lock_sections: %llu\n", totals.lock_sections);
+	seq_printf(m, "max_lock_ns: %llu\n", totals.max_lock_ns);
+	return 0;
+}
+
+static int ofs_debugfs_stats_open(struct inode *inode, struct file *flip) {
+	return single_open(flip, ofs_debugfs_stats_show, NULL);
+}
+
+static const struct file_operations ofs_debugfs_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = ofs_debugfs_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Writing anything to the reset file clears the totals.
+ */
+static ssize_t ofs_debugfs_reset_write(struct file *flip,
+		const char __user *buffer, size_t count, loff_t *offset) {
+	spin_lock(&ofs_totals_lock_);
+	memset(&ofs_totals_, 0, sizeof(ofs_totals_));
+	ofs_total_scans_ = 0;
+	spin_unlock(&ofs_totals_lock_);
+	return count;
+}
+
+static const struct file_operations ofs_debugfs_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = ofs_debugfs_reset_write,
+};
+
+/*
+ * Creates /sys/kernel/debug/openFileSearch (stats, reset). The module works
+ * without debugfs.
+ */
+static void ofs_debugfs_init(void) {
+	ofs_debugfs_ = debugfs_create_dir(MODULE_NAME, NULL);
+	if (IS_ERR_OR_NULL(ofs_debugfs_)) {
+		ofs_debugfs_ = NULL;
+		return;
+	}
+	debugfs_create_file("stats", 0444, ofs_debugfs_, NULL,
+			&ofs_debugfs_stats_fops);
+	debugfs_create_file("reset", 0200, ofs_debugfs_, NULL,
+			&ofs_debugfs_reset_fops);
+}
+
+/*
+ * Continues a streaming search until at most limit results have been found
+ * or all tasks have been searched.
+ */
+static void ofs_stream_fill(struct ofs_session *session, unsigned int limit) {
+	struct ofs_cursor *cursor = &session->cursor;
+	struct task_struct *task;
+	struct task_struct *prev = NULL;
+	struct ofs_stats before;
+	u64 started_at;
+
+	ofs_scan_init(session, limit);
+	session->read_position = 0;
+	started_at = ofs_scan_begin(session, &before);
+
+	while (!cursor->done && ofs_scan_room(&session->scan)) {
+		task = ofs_cursor_task(session, prev);
+		if (prev) {
+			put_task_struct(prev);
+			prev = NULL;
+		}
+		if (!task) {
+			cursor->done = 1;
+			break;
+		}
+		cursor->task_done = ofs_search_task(&session->scan, task,
+				&cursor->fd);
+		prev = task;
+		cond_resched();
+	}
+	if (prev) {
+		put_task_struct(prev);
+	}
+	ofs_scan_end(session, &before, started_at);
+}
+
+/*
+ * Continues a search in ring mode until the ring is full or all tasks have
+ * been searched.
+ *
+ * User space may write the ring at any time, so results are built in the
+ * session's private result array (batches of at most OFS_MAX_RESULTS) and
+ * only finished records are copied into the ring.
+ *
+ * Returns the number of results added to the ring.
+ */
+static unsigned int ofs_ring_fill(struct ofs_session *session) {
+	struct ofs_ring_header *ring = session->ring;
+	unsigned int consumer = smp_load_acquire(&ring->consumer);
+	unsigned int used = session->ring_producer - consumer;
+	unsigned int added = 0;
+	unsigned int free;
+	unsigned int slot;
+	unsigned int i;
+
+	// do not trust the consumer index written by user space
+	free = used <= session->ring_mask + 1
+		? session->ring_mask + 1 - used : 0;
+
+	while (free && !session->cursor.done) {
+		ofs_stream_fill(session, min_t(unsigned int, free,
+					OFS_MAX_RESULTS));
+		for (i = 0; i < session->scan.count; i++) {
+			slot = (session->ring_producer + i) & session->ring_mask;
+			memcpy(&session->ring_records[slot],
+					&session->results[i],
+					sizeof(struct ofs_result));
+		}
+
+		// publish the records before the new producer index
+		session->ring_producer += session->scan.count;
+		smp_store_release(&ring->producer, session->ring_producer);
+		free -= session->scan.count;
+		added += session->scan.count;
+	}
+	if (session->cursor.done) {
+		WRITE_ONCE(ring->done, 1);
+	}
+	return added;
+}
+
+/*
+ * Produces the results of an asynchronous search. The search is continued
+ * like a streaming search until the fifo is full; then the worker returns
+ * (instead of occupying a worker of ofs_scan_wq_, which parallel scans
+ * wait for) and is queued again by read() once results have been read.
+ */
+static void ofs_async_fn(struct work_struct *work) {
+	struct ofs_session *session =
+		container_of(work, struct ofs_session, async.work);
+	struct ofs_async *async = &session->async;
+
+	while (!session->cursor.done) {
+		if (READ_ONCE(async->cancel) || !kfifo_avail(&async->fifo)) {
+			return;
+		}
+
+		// the result array is the staging buffer of the worker
+		ofs_stream_fill(session, kfifo_avail(&async->fifo));
+		if (session->scan.count) {
+			kfifo_in(&async->fifo, session->results,
+					session->scan.count);
+			wake_up_interruptible(&async->ready);
+		}
+	}
+
+	// publish the results before the done flag
+	smp_store_release(&async->done, 1);
+	wake_up_interruptible(&async->ready);
+}
+
+static void ofs_async_start(struct ofs_session *session) {
+	struct ofs_async *async = &session->async;
+
+	kfifo_reset(&async->fifo);
+	async->done = 0;
+	async->cancel = 0;
+	async->active = 1;
+	queue_work(ofs_scan_wq_, &async->work);
+}
+
+/*
+ * Stops the worker of an asynchronous search and waits until it has
+ * returned. Readers waiting for results are woken.
+ */
+static void ofs_async_cancel(struct ofs_session *session) {
+	struct ofs_async *async = &session->async;
+
+	if (!async->active) {
+		return;
+	}
+	WRITE_ONCE(async->cancel, 1);
+	cancel_work_sync(&async->work);
+
+	WRITE_ONCE(async->active, 0);
+	wake_up_interruptible(&async->ready);
+}
+
+/*
+ * Feeds the session's query to the probes: open/close events passing its
+ * filter are added to the rings of the subscription.
+ */
+static long ofs_subscribe(struct ofs_session *session) {
+	struct ofs_subscription *sub = &session->sub;
+	unsigned int cpu;
+	long err;
+
+	if (!sub->rings) {
+		if (!(sub->rings = vzalloc(nr_cpu_ids * sizeof(*sub->rings)))) {
+			printk(KERN_ERR "openFileSearch: Failed to allocate " \
+					"memory for event rings\n");
+			return -ENOMEM;
+		}
+	} else {
+		for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+			sub->rings[cpu].head = 0;
+			sub->rings[cpu].lost = 0;
+			sub->rings[cpu].tail = 0;
+			sub->rings[cpu].reported = 0;
+		}
+	}
+
+	if ((err = ofs_probes_get())) {
+		return err;
+	}
+	sub->query = &session->query;
+	sub->next_cpu = 0;
+	sub->active = 1;
+
+	spin_lock(&ofs_subscribers_lock_);
+	list_add_rcu(&sub->list, &ofs_subscribers_);
+	spin_unlock(&ofs_subscribers_lock_);
+	return 0;
+}
+
+/*
+ * Ends the subscription of the session (if any) and waits until no probe
+ * uses it anymore. Readers waiting for events are woken.
+ */
+static void ofs_unsubscribe(struct ofs_session *session) {
+	struct ofs_subscription *sub = &session->sub;
+
+	if (!sub->active) {
+		return;
+	}
+
+	spin_lock(&ofs_subscribers_lock_);
+	list_del_rcu(&sub->list);
+	spin_unlock(&ofs_subscribers_lock_);
+	synchronize_rcu();
+	ofs_probes_put();
+
+	WRITE_ONCE(sub->active, 0);
+	wake_up_interruptible(sub->wait);
+}
+
+/*
+ * Takes the snapshot of the tasks walked by the cursor of a streaming, ring
+ * or asynchronous search in OFS_MODE_DEDUP: all threads with distinct fd
+ * tables. Without a snapshot the cursor walks the task list.
+ */
+static void ofs_cursor_collect(struct ofs_session *session) {
+	if (!(session->mode & OFS_MODE_DEDUP) || session->query.pid) {
+		return;
+	}
+	if (!(session->task_count = ofs_collect_tasks(&session->tasks,
+					true))) {
+		vfree(session->tasks);
+		session->tasks = NULL;
+	}
+}
+
+static void new_search(struct ofs_session *session) {
+	// the worker of an asynchronous search and the probes use the query
+	ofs_async_cancel(session);
+	ofs_unsubscribe(session);
+
+	if (session->tasks) {
+		ofs_put_tasks(session->tasks, session->task_count);
+		session->tasks = NULL;
+	}
+	if (session->snapshot) {
+		ofs_put_snapshot(session->snapshot);
+		session->snapshot = NULL;
+	}
+
+	// release the path and program held by the previous query
+	ofs_put_query(&session->query);
+
+	session->query.stream = 0;
+	session->query.scope = session->scope.pid_ns || session->scope.cgroup
+		? &session->scope : NULL;
+	session->query.pid_ns = get_pid_ns(task_active_pid_ns(current));
+	session->search_performed = 0;
+	session->read_position = 0;
+	memset(&session->cursor, 0, sizeof(session->cursor));
+	memset(&session->stats, 0, sizeof(session->stats));
+
+	if (smp_load_acquire(&session->ring)) {
+		session->ring_producer = 0;
+		WRITE_ONCE(session->ring->producer, 0);
+		WRITE_ONCE(session->ring->consumer, 0);
+		WRITE_ONCE(session->ring->done, 0);
+	}
+	ofs_scan_init(session, OFS_MAX_RESULTS);
+}
+
+/*
+ * Scans the open files of the query's process or of all processes into the
+ * session's scan (results, groups or ranking).
+ *
+ * The index and parallel scans are bounded by the size of a result array,
+ * so they are not used by aggregations and rankings.
+ */
+static void ofs_search_snapshot(struct ofs_session *session) {
+	struct ofs_scan *scan = &session->scan;
+	struct task_struct *task;
+	struct ofs_stats before;
+	u64 started_at = ofs_scan_begin(session, &before);
+
+	if (session->query.pid) {
+		rcu_read_lock();
+		if ((task = pid_task(session->query.pid_ref, PIDTYPE_PID))) {
+			get_task_struct(task);
+		}
+		rcu_read_unlock();
+		if (task) {
+			ofs_search_task(scan, task, &session->cursor.fd);
+			put_task_struct(task);
+		}
+	} else if (scan->aggregation || scan->ranking) {
+		ofs_search_all(scan);
+	} else if ((session->mode & OFS_MODE_INDEX) && ofs_index_search(scan)) {
+		// served from the open file index
+	} else if (session->mode & OFS_MODE_PARALLEL) {
+		ofs_search_all_parallel(scan);
+	} else {
+		ofs_search_all(scan);
+	}
+	ofs_scan_end(session, &before, started_at);
+}
+
+// the snapshots of the cache, at most one per criteria
+// (protected by ofs_cache_lock_)
+static LIST_HEAD(ofs_cache_);
+static DEFINE_SPINLOCK(ofs_cache_lock_);
+
+static void ofs_free_snapshot(struct kref *ref) {
+	struct ofs_snapshot *snapshot = container_of(ref,
+			struct ofs_snapshot, ref);
+
+	put_pid_ns(snapshot->pid_ns);
+	path_put(&snapshot->root);
+	vfree(snapshot);
+}
+
+static void ofs_put_snapshot(struct ofs_snapshot *snapshot) {
+	kref_put(&snapshot->ref, ofs_free_snapshot);
+}
+
+/*
+ * Returns whether the results of the session's search may be shared via
+ * the cache: OFS_UID and OFS_OWNER searches of all processes without a
+ * scope. The other search commands depend on paths or programs of the
+ * caller. Results of parallel scans are not cached: their names are built
+ * relative to the root of the workers, not the root snapshots are kept
+ * under.
+ */
+static bool ofs_cacheable(struct ofs_session *session) {
+	const struct ofs_query *query = &session->query;
+
+	return READ_ONCE(ofs_cache_ttl_ms) && !query->pid && !query->scope
+		&& !(session->mode & OFS_MODE_PARALLEL)
+		&& (query->filter == &ofs_uid_filter
+				|| query->filter == &ofs_owner_filter);
+}
+
+// root is the root of the caller (names of chroot()ed callers differ)
+static inline bool ofs_snapshot_matches(const struct ofs_snapshot *snapshot,
+		const struct ofs_session *session, const struct path *root) {
+	return snapshot->filter == session->query.filter
+		&& snapshot->id == session->query.arg.id
+		&& snapshot->pid_ns == session->query.pid_ns
+		&& path_equal(&snapshot->root, root)
+		&& snapshot->dedup == !!(session->mode & OFS_MODE_DEDUP);
+}
+
+/*
+ * Drops all snapshots, e.g. once the cache has been disabled by setting
+ * ofs_cache_ttl_ms to 0. Sessions reading a snapshot keep it until they
+ * drop their reference.
+ */
+static void ofs_cache_flush(void) {
+	struct ofs_snapshot *snapshot;
+	struct ofs_snapshot *next;
+	LIST_HEAD(dropped);
+
+	spin_lock(&ofs_cache_lock_);
+	list_splice_init(&ofs_cache_, &dropped);
+	spin_unlock(&ofs_cache_lock_);
+
+	// vfree() must not be called under the spinlock
+	list_for_each_entry_safe(snapshot, next, &dropped, list) {
+		ofs_put_snapshot(snapshot);
+	}
+}
+
+/*
+ * Looks up an unexpired snapshot of the session's search in the cache and
+ * makes it the session's results. Expired snapshots are dropped on the way.
+ * Returns whether a snapshot has been found.
+ */
+static bool ofs_cache_lookup(struct ofs_session *session) {
+	struct ofs_snapshot *snapshot;
+	struct ofs_snapshot *next;
+	struct ofs_snapshot *found = NULL;
+	struct path root;
+	LIST_HEAD(expired);
+	u64 now = ktime_get_ns();
+
+	get_fs_root(current->fs, &root);
+	spin_lock(&ofs_cache_lock_);
+	list_for_each_entry_safe(snapshot, next, &ofs_cache_, list) {
+		if (now >= snapshot->expires) {
+			list_move(&snapshot->list, &expired);
+		} else if (!found && ofs_snapshot_matches(snapshot, session,
+					&root)) {
+			kref_get(&snapshot->ref);
+			found = snapshot;
+		}
+	}
+	if (found) {
+		ofs_cache_hits_++;
+	} else {
+		ofs_cache_misses_++;
+	}
+	spin_unlock(&ofs_cache_lock_);
+	path_put(&root);
+
+	// vfree() must not be called under the spinlock
+	list_for_each_entry_safe(snapshot, next, &expired, list) {
+		ofs_put_snapshot(snapshot);
+	}
+
+	if (found) {
+		session->snapshot = found;
+		session->scan.count = found->count;
+	}
+	return found;
+}
+
+/*
+ * Publishes the results of the session's search as a snapshot, replacing
+ * the snapshot of the same criteria (if any). Concurrent misses each scan
+ * and the last one is kept. Nothing is cached if no memory is available.
+ */
+static void ofs_cache_insert(struct ofs_session *session) {
+	struct ofs_snapshot *snapshot;
+	struct ofs_snapshot *old;
+	struct ofs_snapshot *replaced = NULL;
+	unsigned int count = session->scan.count;
+
+	if (!(snapshot = vmalloc(sizeof(*snapshot)
+					+ count * sizeof(struct ofs_result)))) {
+		return;
+	}
+	kref_init(&snapshot->ref);
+	snapshot->filter = session->query.filter;
+	snapshot->id = session->query.arg.id;
+	snapshot->pid_ns = get_pid_ns(session->query.pid_ns);
+	get_fs_root(current->fs, &snapshot->root);
+	snapshot->dedup = session->mode & OFS_MODE_DEDUP;
+	snapshot->expires = ktime_get_ns()
+		+ (u64) READ_ONCE(ofs_cache_ttl_ms) * NSEC_PER_MSEC;
+	snapshot->count = count;
+	memcpy(snapshot->results, session->results,
+			count * sizeof(struct ofs_result));
+
+	spin_lock(&ofs_cache_lock_);
+	list_for_each_entry(old, &ofs_cache_, list) {
+		if (ofs_snapshot_matches(old, session, &snapshot->root)) {
+			list_del(&old->list);
+			replaced = old;
+			break;
+		}
+	}
+	list_add(&snapshot->list, &ofs_cache_);
+	spin_unlock(&ofs_cache_lock_);
+
+	if (replaced) {
+		ofs_put_snapshot(replaced);
+	}
+}
+
+static void ofs_cache_exit(void) {
+	// no session is left, so the cache holds the last references
+	ofs_cache_flush();
+}
+
+/*
+ * Performs the search described by session->query.
+ *
+ * In streaming mode only the cursor is reset; the actual search is done
+ * on demand by read(). In ring mode the ring is filled right away. In
+ * asynchronous mode the search is queued to a worker. A subscription
+ * (OFS_SUBSCRIBE) does not search at all but watches for events. An
+ * aggregation (OFS_AGGREGATE), ranking (OFS_TOP) or query of a batch
+ * (OFS_BATCH) always scans right away and keeps no results to be read.
+ */
+static long ofs_run_search(struct ofs_session *session) {
+	long err;
+
+	if (session->subscribing) {
+		if ((err = ofs_subscribe(session))) {
+			return err;
+		}
+	} else if (ofs_direct(session)) {
+		ofs_scan_init(session, session->batch_limit
+				? session->batch_limit : OFS_MAX_RESULTS);
+		ofs_search_snapshot(session);
+		return 0;
+	} else if (session->mode & OFS_MODE_RING) {
+		ofs_cursor_collect(session);
+		ofs_ring_fill(session);
+	} else if (session->mode & OFS_MODE_ASYNC) {
+		ofs_cursor_collect(session);
+		ofs_async_start(session);
+	} else if (!ofs_streaming(session)) {
+		if (!ofs_cacheable(session)) {
+			// snapshots left over from before the cache was disabled
+			if (!READ_ONCE(ofs_cache_ttl_ms)
+					&& !list_empty(&ofs_cache_)) {
+				ofs_cache_flush();
+			}
+			ofs_scan_init(session, OFS_MAX_RESULTS);
+			ofs_search_snapshot(session);
+		} else if (!ofs_cache_lookup(session)) {
+			ofs_scan_init(session, OFS_MAX_RESULTS);
+			ofs_search_snapshot(session);
+			ofs_cache_insert(session);
+		}
+	} else {
+		ofs_cursor_collect(session);
+	}
+	session->search_performed = 1;
+	return 0;
+}
+
+static long ofs_search_open_files_by_pid(struct ofs_session *session,
+		pid_t requested_pid) {
+	struct task_struct *task;
+
+	ofs_info("Searching for open files of process %d\n", requested_pid);
+
+	new_search(session);
+
+	rcu_read_lock();
+	if (requested_pid <= 0 || !(task = pid_task(find_vpid(requested_pid),
+					PIDTYPE_PID))) {
+		rcu_read_unlock();
+		printk(KERN_WARNING "openFileSearch: PID %d not found\n",
+				requested_pid);
+		return -EINVAL;
+	}
+	// remember the task so a reused pid is detected by a streaming search
+	session->cursor.pid = task->pid;
+	session->cursor.start_time = task->start_time;
+	// resolved here, in the caller's pid namespace (see ofs_query.pid_ref)
+	session->query.pid_ref = get_pid(task_pid(task));
+	rcu_read_unlock();
+
+	session->query.filter = &ofs_no_filter;
+	session->query.pid = requested_pid;
+	return ofs_run_search(session);
+}
+
+static long ofs_search_open_files_by_uid(struct ofs_session *session,
+		unsigned int uid) {
+	ofs_info("Searching for open files of user %u\n", uid);
+
+	new_search(session);
+	session->query.filter = &ofs_uid_filter;
+	session->query.pid = 0;
+	session->query.arg.id = uid;
+	return ofs_run_search(session);
+}
+
+static long ofs_search_open_files_by_owner(struct ofs_session *session,
+		unsigned int owner) {
+	ofs_info("Searching for open files owned by user %u\n", owner);
+
+	new_search(session);
+	session->query.filter = &ofs_owner_filter;
+	session->query.pid = 0;
+	session->query.arg.id = owner;
+	return ofs_run_search(session);
+}
+
+static long ofs_search_open_files_by_name(struct ofs_session *session,
+		__user char *name) {
+	char *filename;
+	size_t length;
+	long err;
+
+	if (!(filename = kmalloc(OFS_RESULT_NAME_MAX_LENGTH * sizeof(char),
+					GFP_KERNEL))) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				" for filename\n");
+		return -EIO;
+	}
+
+	if (copy_from_user(filename, name, OFS_RESULT_NAME_MAX_LENGTH
+				* sizeof(char))) {
+		printk(KERN_ERR "openFileSearch: Failed to copy filename to " \
+				"kernel memory\n");
+		kfree(filename);
+		return -EIO;
+	}
+
+	length = strnlen(filename, OFS_RESULT_NAME_MAX_LENGTH);
+	if (length == OFS_RESULT_NAME_MAX_LENGTH) {
+		// the length must not be higher than max - 1 in order to be
+		// properly NULL-terminated!
+		printk(KERN_WARNING "openFileSearch: Searched filename must " \
+				"not be longer than %u characters " \
+				"(including '\\0').\n",
+				OFS_RESULT_NAME_MAX_LENGTH);
+		kfree(filename);
+		return -EINVAL;
+	}
+
+	ofs_info("Searching for open files named %s\n", filename);
+
+	new_search(session);
+	session->query.filter = &ofs_name_filter;
+	session->query.pid = 0;
+	strlcpy(session->query.arg.name, filename, OFS_RESULT_NAME_MAX_LENGTH);
+	err = ofs_run_search(session);
+	kfree(filename);
+	return err;
+}
+
+/*
+ * Resolves the path once and matches open files by inode identity (like
+ * fuser). Also finds files opened via hard links or bind mounts.
+ */
+static long ofs_search_open_files_by_inode(struct ofs_session *session,
+		__user char *name) {
+	char *filename;
+	long err;
+
+	if (IS_ERR(filename = strndup_user(name, PATH_MAX))) {
+		return PTR_ERR(filename);
+	}
+
+	ofs_info("Searching for open files with the inode of %s\n",
+			filename);
+
+	new_search(session);
+	if ((err = kern_path(filename, LOOKUP_FOLLOW, &session->query.path))) {
+		printk(KERN_WARNING "openFileSearch: Failed to resolve %s " \
+				"(%ld)\n", filename, err);
+		session->query.path.dentry = NULL;
+		kfree(filename);
+		return err;
+	}
+	kfree(filename);
+
+	session->query.filter = &ofs_inode_filter;
+	session->query.pid = 0;
+	session->query.arg.file.inode = d_inode(session->query.path.dentry);
+	session->query.arg.file.sb = session->query.path.dentry->d_sb;
+	return ofs_run_search(session);
+}
+
+/*
+ * Finds all open files below a directory (including files on mounts below
+ * it). Matches are checked by dentry/mount ancestry instead of by name and
+ * are always returned via the streaming read path.
+ */
+static long ofs_search_open_files_by_subtree(struct ofs_session *session,
+		__user char *name) {
+	char *dirname;
+	long err;
+
+	if (IS_ERR(dirname = strndup_user(name, PATH_MAX))) {
+		return PTR_ERR(dirname);
+	}
+
+	ofs_info("Searching for open files below %s\n", dirname);
+
+	new_search(session);
+	if ((err = kern_path(dirname, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
+					&session->query.path))) {
+		printk(KERN_WARNING "openFileSearch: Failed to resolve %s " \
+				"(%ld)\n", dirname, err);
+		session->query.path.dentry = NULL;
+		kfree(dirname);
+		return err;
+	}
+	kfree(dirname);
+
+	session->query.filter = &ofs_subtree_filter;
+	session->query.pid = 0;
+	session->query.arg.subtree.dir = &session->query.path;
+	session->query.arg.subtree.mnt_ns = current->nsproxy->mnt_ns;
+	session->query.stream = 1;
+	return ofs_run_search(session);
+}
+
+/*
+ * Finds all open files matching a predicate program in a single pass. The
+ * program is validated and compiled once.
+ */
+static long ofs_search_open_files_by_program(struct ofs_session *session,
+		__user struct ofs_program *user_program) {
+	struct ofs_program *program;
+	struct ofs_prog *prog;
+	long err;
+
+	if (IS_ERR(program = memdup_user(user_program, sizeof(*program)))) {
+		return PTR_ERR(program);
+	}
+
+	if (!(prog = kmalloc(sizeof(*prog), GFP_KERNEL))) {
+		kfree(program);
+		return -ENOMEM;
+	}
+
+	if ((err = ofs_prog_compile(prog, program))) {
+		printk(KERN_WARNING "openFileSearch: Invalid program\n");
+		kfree(prog);
+		kfree(program);
+		return err;
+	}
+	kfree(program);
+
+	ofs_info("Searching for open files matching a program of %u " \
+			"instructions\n", prog->length);
+
+	new_search(session);
+	session->query.filter = &ofs_prog_filter;
+	session->query.pid = 0;
+	session->query.prog = prog;
+	session->query.arg.prog = prog;
+	return ofs_run_search(session);
+}
+
+static long ofs_set_mode(struct ofs_session *session, unsigned int mode) {
+	if (mode & ~OFS_MODE_ALL) {
+		printk(KERN_WARNING "openFileSearch: Unknown mode 0x%x\n",
+				mode);
+		return -EINVAL;
+	}
+
+	if ((mode & OFS_MODE_RING) && !smp_load_acquire(&session->ring)) {
+		printk(KERN_WARNING "openFileSearch: Ring mode requires " \
+				"a prior mmap()\n");
+		return -EINVAL;
+	}
+
+	// the workers would build names relative to their root
+	if ((mode & OFS_MODE_PARALLEL) && !ofs_worker_root()) {
+		printk(KERN_WARNING "openFileSearch: Parallel mode is not " \
+				"available below a different root\n");
+		return -EINVAL;
+	}
+
+	if ((mode & OFS_MODE_INDEX) && !ofs_index_ready_) {
+		printk(KERN_WARNING "openFileSearch: Index mode requires " \
+				"the module parameter ofs_index=1\n");
+		return -EINVAL;
+	}
+
+	if ((mode & OFS_MODE_ASYNC) && (mode & OFS_MODE_RING)) {
+		printk(KERN_WARNING "openFileSearch: Asynchronous mode " \
+				"cannot be combined with ring mode\n");
+		return -EINVAL;
+	}
+
+	if ((mode & OFS_MODE_V2) && (mode & (OFS_MODE_RING | OFS_MODE_ASYNC))) {
+		printk(KERN_WARNING "openFileSearch: v2 mode cannot be " \
+				"combined with ring or asynchronous mode\n");
+		return -EINVAL;
+	}
+
+	if ((mode & OFS_MODE_TYPED) && !(mode & OFS_MODE_V2)) {
+		printk(KERN_WARNING "openFileSearch: Typed mode requires " \
+				"v2 mode\n");
+		return -EINVAL;
+	}
+
+	if ((mode & OFS_MODE_V2) && !session->records
+			&& !(session->records = vmalloc(OFS_RECORD_BUFFER_SIZE))) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for records\n");
+		return -ENOMEM;
+	}
+
+	if ((mode & OFS_MODE_DEDUP) && !session->seen
+			&& !(session->seen = kzalloc(sizeof(struct ofs_seen_file)
+					<< OFS_SEEN_BITS, GFP_KERNEL))) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for de-duplication\n");
+		return -ENOMEM;
+	}
+
+	if ((mode & OFS_MODE_ASYNC) && !kfifo_initialized(&session->async.fifo)
+			&& kfifo_alloc(&session->async.fifo, OFS_MAX_RESULTS,
+				GFP_KERNEL)) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for asynchronous results\n");
+		return -ENOMEM;
+	}
+
+	// a mode change discards the current search
+	new_search(session);
+	session->mode = mode;
+	return 0;
+}
+
+/*
+ * Restricts all following searches of a session to the tasks of a pid
+ * namespace and/or a cgroup (OFS_SET_SCOPE).
+ */
+static long ofs_set_scope(struct ofs_session *session,
+		struct ofs_scope __user *user_scope) {
+	struct ofs_scope scope;
+	struct ofs_task_scope task_scope = { NULL, NULL };
+	struct task_struct *task;
+	char *path;
+
+	if (copy_from_user(&scope, user_scope, sizeof(scope))) {
+		return -EFAULT;
+	}
+
+	if (scope.pid) {
+		rcu_read_lock();
+		if (scope.pid > 0 && (task = pid_task(find_vpid(scope.pid),
+						PIDTYPE_PID))) {
+			task_scope.pid_ns = get_pid_ns(task_active_pid_ns(
+						task));
+		}
+		rcu_read_unlock();
+		if (!task_scope.pid_ns) {
+			printk(KERN_WARNING "openFileSearch: PID %d not " \
+					"found\n", scope.pid);
+			return -EINVAL;
+		}
+	}
+
+	if (scope.cgroup) {
+		if (IS_ERR(path = strndup_user((const char __user *)
+						(unsigned long) scope.cgroup,
+						PATH_MAX))) {
+			ofs_put_scope(&task_scope);
+			return PTR_ERR(path);
+		}
+		task_scope.cgroup = cgroup_get_from_path(path);
+		if (IS_ERR(task_scope.cgroup)) {
+			printk(KERN_WARNING "openFileSearch: cgroup %s not " \
+					"found\n", path);
+			kfree(path);
+			task_scope.cgroup = NULL;
+			ofs_put_scope(&task_scope);
+			return -EINVAL;
+		}
+		ofs_info("Restricting searches to cgroup %s\n", path);
+		kfree(path);
+	}
+	if (scope.pid) {
+		ofs_info("Restricting searches to the pid namespace of " \
+				"process %d\n", scope.pid);
+	}
+
+	// a scope change discards the current search
+	new_search(session);
+	ofs_put_scope(&session->scope);
+	session->scope = task_scope;
+	session->query.scope = task_scope.pid_ns || task_scope.cgroup
+		? &session->scope : NULL;
+	return 0;
+}
+
+static long ofs_get_stats(struct ofs_session *session,
+		struct ofs_stats __user *stats) {
+	if (copy_to_user(stats, &session->stats, sizeof(*stats))) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+static long ofs_check_index(struct ofs_index_check __user *user_check) {
+	struct ofs_index_check check;
+	bool repair;
+	long err;
+
+	if (!ofs_index_ready_) {
+		printk(KERN_WARNING "openFileSearch: Index is not enabled\n");
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&check, user_check, sizeof(check))) {
+		return -EFAULT;
+	}
+	repair = check.repair;
+	if (repair && !capable(CAP_SYS_ADMIN)) {
+		return -EPERM;
+	}
+
+	memset(&check, 0, sizeof(check));
+	check.repair = repair;
+	if ((err = ofs_index_sync(&check, repair))) {
+		return err;
+	}
+
+	ofs_info("Index check: %llu fds scanned, %llu indexed, " \
+			"%llu missing, %llu stale, %llu mismatched\n",
+			check.scanned, check.indexed, check.missing,
+			check.stale, check.mismatched);
+	if (copy_to_user(user_check, &check, sizeof(check))) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+static long ofs_ring_refill(struct ofs_session *session) {
+	if (!(session->mode & OFS_MODE_RING) || !session->search_performed) {
+		return -ESRCH;
+	}
+	return ofs_ring_fill(session);
+}
+
+/*
+ * Performs a search command. Called with the session's lock held.
+ */
+static long ofs_search_cmd(struct ofs_session *session,
+		unsigned int ioctl_cmd, unsigned long ioctl_arg) {
+	unsigned int __user *uint_arg = (unsigned int __user *) ioctl_arg;
+	unsigned int value;
+	long err;
+
+	// numeric arguments are passed by pointer
+	if ((ioctl_cmd == OFS_PID || ioctl_cmd == OFS_UID
+				|| ioctl_cmd == OFS_OWNER)
+			&& get_user(value, uint_arg)) {
+		return -EFAULT;
+	}
+
+	switch (ioctl_cmd) {
+		case OFS_PID:
+			err = ofs_search_open_files_by_pid(session,
+					(pid_t) value);
+			break;
+		case OFS_UID:
+			err = ofs_search_open_files_by_uid(session, value);
+			break;
+		case OFS_OWNER:
+			err = ofs_search_open_files_by_owner(session, value);
+			break;
+		case OFS_NAME:
+			err = ofs_search_open_files_by_name(session,
+					(char __user *) ioctl_arg);
+			break;
+		case OFS_INODE:
+			err = ofs_search_open_files_by_inode(session,
+					(char __user *) ioctl_arg);
+			break;
+		case OFS_SUBTREE:
+			err = ofs_search_open_files_by_subtree(session,
+					(char __user *) ioctl_arg);
+			break;
+		case OFS_PROGRAM:
+			err = ofs_search_open_files_by_program(session,
+					(struct ofs_program __user *) ioctl_arg);
+			break;
+		default:
+			printk(KERN_WARNING "openFileSearch: Unknown search " \
+					"command %u\n", ioctl_cmd);
+			return -EINVAL;
 	}
-	device_opened_ = 1;
 
-	if (!(results_ = kmalloc(OFS_MAX_RESULTS * sizeof(struct ofs_result),
-					GFP_KERNEL))) {
-		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
-				"for results\n");
-		return -1;
+	if (!err && !session->subscribing && !ofs_direct(session)
+			&& !ofs_streaming(session)
+			&& !(session->mode & (OFS_MODE_RING | OFS_MODE_ASYNC))) {
+		ofs_info("%d results found\n", session->scan.count);
 	}
+	return err;
+}
 
-	// discard search performed by prior caller
-	search_performed_ = 0;
+/*
+ * Subscribes to the open/close events matching the criteria of a search
+ * command. Discards the current search.
+ */
+static long ofs_subscribe_cmd(struct ofs_session *session,
+		struct ofs_subscribe __user *user_subscribe) {
+	struct ofs_subscribe subscribe;
+	long err;
 
-	printk(KERN_INFO "openFileSearch: Opened\n");
-	return 0;
+	if (copy_from_user(&subscribe, user_subscribe, sizeof(subscribe))) {
+		return -EFAULT;
+	}
+
+	ofs_info("Subscribing to events\n");
+	session->subscribing = 1;
+	err = ofs_search_cmd(session, subscribe.ioctl_cmd,
+			(unsigned long) subscribe.ioctl_arg);
+	session->subscribing = 0;
+	return err;
 }
 
-static int ofs_release(struct inode *inode, struct file *flip) {
-	device_opened_ = 0;
-	kfree(results_);
+/*
+ * Performs a search command and counts the matching open files per group
+ * (uid, pid or file) instead of keeping them. Only the groups are copied to
+ * user space. Discards the current search.
+ */
+static long ofs_aggregate_cmd(struct ofs_session *session,
+		struct ofs_aggregate __user *user_aggregate) {
+	struct ofs_aggregate aggregate;
+	struct ofs_aggregation aggregation;
+	unsigned int slot;
+	long err;
 
-	printk(KERN_INFO "openFileSearch: Released\n");
-	return 0;
-}
+	if (copy_from_user(&aggregate, user_aggregate, sizeof(aggregate))) {
+		return -EFAULT;
+	}
 
-typedef int (*ofs_result_filter)(struct ofs_result *, void *);
+	if (aggregate.group_by < OFS_GROUP_BY_UID
+			|| aggregate.group_by > OFS_GROUP_BY_FILE
+			|| !aggregate.capacity
+			|| aggregate.capacity > OFS_MAX_GROUPS) {
+		printk(KERN_WARNING "openFileSearch: Invalid aggregation\n");
+		return -EINVAL;
+	}
 
-int ofs_no_filter(struct ofs_result *result, void *filter_arg) {
-	return 1;
-}
+	memset(&aggregation, 0, sizeof(aggregation));
+	aggregation.group_by = aggregate.group_by;
+	aggregation.capacity = aggregate.capacity;
+	aggregation.bits = ilog2(roundup_pow_of_two(aggregate.capacity * 2));
+	aggregation.mask = (1U << aggregation.bits) - 1;
+	if (!(aggregation.groups = vzalloc((aggregation.mask + 1)
+					* sizeof(struct ofs_group)))) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for groups\n");
+		return -ENOMEM;
+	}
 
-int ofs_filter_by_uid(struct ofs_result *result, void *filter_arg) {
-	unsigned int uid = *(unsigned int *) filter_arg;
-	return result->uid == uid;
-}
+	session->aggregation = &aggregation;
+	err = ofs_search_cmd(session, aggregate.ioctl_cmd,
+			(unsigned long) aggregate.ioctl_arg);
+	session->aggregation = NULL;
+	if (err) {
+		vfree(aggregation.groups);
+		return err;
+	}
 
-int ofs_filter_by_owner(struct ofs_result *result, void *filter_arg) {
-	unsigned int owner = *(unsigned int *) filter_arg;
-	return result->owner == owner;
-}
+	// move the groups to the front of the table
+	aggregate.group_count = 0;
+	for (slot = 0; slot <= aggregation.mask; slot++) {
+		if (aggregation.groups[slot].count) {
+			aggregation.groups[aggregate.group_count++] =
+				aggregation.groups[slot];
+		}
+	}
+	aggregate.matches = aggregation.matches;
+	aggregate.dropped = aggregation.dropped;
 
-int ofs_filter_by_name(struct ofs_result *result, void *filter_arg) {
-	char * name = (char *) filter_arg;
-	return strncmp(result->name, name, OFS_RESULT_NAME_MAX_LENGTH) == 0;
+	ofs_info("%llu results in %u groups\n",
+			aggregate.matches, aggregate.group_count);
+	if (copy_to_user((struct ofs_group __user *) (unsigned long)
+				aggregate.groups, aggregation.groups,
+				aggregate.group_count * sizeof(struct ofs_group))
+			|| copy_to_user(user_aggregate, &aggregate,
+				sizeof(aggregate))) {
+		err = -EFAULT;
+	}
+	vfree(aggregation.groups);
+	return err;
 }
 
-static void ofs_path_to_result(struct ofs_result *result, struct path *path) {
-	char *name = d_path(path, result->name, OFS_RESULT_NAME_MAX_LENGTH);
-	char *short_name;
+/*
+ * Performs a search command and returns only the top k open files by size
+ * or processes by number of matching open files, in descending order.
+ * Discards the current search.
+ */
+static long ofs_top_cmd(struct ofs_session *session,
+		struct ofs_top __user *user_top) {
+	struct ofs_top top;
+	struct ofs_ranking ranking;
+	unsigned int count;
+	long err;
 
-	if (IS_ERR(name)) {
-		if (PTR_ERR(name) == -ENAMETOOLONG) {
-			short_name = path->dentry->d_iname;
-			printk(KERN_WARNING "openFileSearch: filename too " \
-					" long, using short version: %s\n",
-					short_name);
-			strlcpy(result->name, short_name,
-					OFS_RESULT_NAME_MAX_LENGTH);
-		} else {
-			printk(KERN_ERR "Failed to build filename\n");
-			strcpy(result->name, "(error)");
-		}
-	} else {
-		strlcpy(result->name, name, OFS_RESULT_NAME_MAX_LENGTH);
+	if (copy_from_user(&top, user_top, sizeof(top))) {
+		return -EFAULT;
 	}
-}
 
-static void ofs_inode_to_result(struct ofs_result *result, struct inode *inode) {
-	inode_lock_shared(inode);
-	result->permissions = inode->i_mode;
-	result->owner = (inode->i_uid).val;
-	result->fsize = inode->i_size;
-	result->inode_no = inode->i_ino;
-	inode_unlock_shared(inode);
-}
+	if ((top.rank_by != OFS_RANK_SIZE && top.rank_by != OFS_RANK_FDS)
+			|| !top.k || top.k > OFS_MAX_TOP) {
+		printk(KERN_WARNING "openFileSearch: Invalid ranking\n");
+		return -EINVAL;
+	}
 
-static void ofs_build_result(pid_t pid, uid_t uid, struct file *open_fd) {
-	struct ofs_result *result = &results_[result_count_];
+	memset(&ranking, 0, sizeof(ranking));
+	ranking.rank_by = top.rank_by;
+	ranking.k = top.k;
+	if (!(ranking.heap = vzalloc(top.k * sizeof(struct ofs_ranked)))) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for ranking\n");
+		return -ENOMEM;
+	}
 
-	result->pid = pid;
-	result->uid = uid;
+	session->ranking = &ranking;
+	err = ofs_search_cmd(session, top.ioctl_cmd,
+			(unsigned long) top.ioctl_arg);
+	session->ranking = NULL;
+	if (err) {
+		vfree(ranking.heap);
+		return err;
+	}
 
-	ofs_path_to_result(result, &open_fd->f_path);
-	ofs_inode_to_result(result, open_fd->f_inode);
-}
+	// heap sort: moving the lowest entry to the end -> descending ranks
+	for (count = ranking.count; count > 1; count--) {
+		swap(ranking.heap[0], ranking.heap[count - 1]);
+		ofs_ranking_sift_down(ranking.heap, count - 1, 0);
+	}
+	top.count = ranking.count;
+	top.matches = ranking.matches;
 
-static void ofs_filter_result(ofs_result_filter filter, void *filter_arg) {
-	if (filter(&results_[result_count_], filter_arg)) {
-		// include this open file in the results
-		result_count_++;
+	ofs_info("%llu results, top %u returned\n",
+			top.matches, top.count);
+	if (copy_to_user((struct ofs_ranked __user *) (unsigned long)
+				top.results, ranking.heap,
+				top.count * sizeof(struct ofs_ranked))
+			|| copy_to_user(user_top, &top, sizeof(top))) {
+		err = -EFAULT;
 	}
-	// else the result will be overwritten by the next result
+	vfree(ranking.heap);
+	return err;
 }
 
-static void ofs_search(struct task_struct *task, ofs_result_filter filter,
-		void *filter_arg) {
-	pid_t pid = task->pid;
-	uid_t uid;
-	struct files_struct *files;
-	struct fdtable *fdt;
-	unsigned int fd;
-	unsigned int max_fds;
-	struct file *open_fd;
+/*
+ * Performs a batch of search commands in a single ioctl() and copies the
+ * results of all of them, each tagged with the index of its query. Every
+ * query returns at most OFS_MAX_RESULTS results. Discards the current
+ * search.
+ */
+static long ofs_batch_cmd(struct ofs_session *session,
+		struct ofs_batch __user *user_batch) {
+	struct ofs_batch batch;
+	struct ofs_batch_query query;
+	struct ofs_batch_query __user *queries;
+	struct ofs_batch_result __user *results;
+	struct ofs_batch_result *tagged;
+	unsigned int count;
+	unsigned int i;
+	long err = 0;
 
-	rcu_read_lock();
-	uid = rcu_dereference(task->cred)->uid.val;
-	rcu_read_unlock();
+	if (copy_from_user(&batch, user_batch, sizeof(batch))) {
+		return -EFAULT;
+	}
 
-	task_lock(task);
-	files = task->files;
+	if (!batch.query_count || batch.query_count > OFS_MAX_BATCH) {
+		printk(KERN_WARNING "openFileSearch: Invalid batch\n");
+		return -EINVAL;
+	}
+	queries = (struct ofs_batch_query __user *) (unsigned long)
+		batch.queries;
+	results = (struct ofs_batch_result __user *) (unsigned long)
+		batch.results;
 
-	rcu_read_lock();
-	// (see <kernel>/Documentation/filesystems/files.txt)
-	// (files_struct::fdt initially points to files_struct::fdtab but
-	// elsewhere after possible expansion of fdtable)
-	fdt = files_fdtable(files);
+	if (!(tagged = kmalloc_array(OFS_MAX_RESULTS, sizeof(*tagged),
+					GFP_KERNEL))) {
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for batch results\n");
+		return -ENOMEM;
+	}
 
-	max_fds = fdt->max_fds;
-	for (fd = 0; result_count_ < OFS_MAX_RESULTS && fd < max_fds; fd++) {
-		if (fd_is_open(fd, fdt)) {
-			rcu_read_lock();
-			// it's recommended to use fcheck_files() here
-			// but it would check if fd < max_fds on every call
-			open_fd = rcu_dereference_raw(fdt->fd[fd]);
-			ofs_build_result(pid, uid, open_fd);
-			ofs_filter_result(filter, filter_arg);
-			rcu_read_unlock();
+	batch.result_count = 0;
+	for (batch.completed = 0; batch.completed < batch.query_count
+			&& batch.result_count < batch.capacity;
+			batch.completed++) {
+		if (copy_from_user(&query, &queries[batch.completed],
+					sizeof(query))) {
+			err = -EFAULT;
+			break;
+		}
+
+		session->batch_limit = min_t(unsigned int, OFS_MAX_RESULTS,
+				batch.capacity - batch.result_count);
+		// a failed query does not fail the batch
+		query.error = ofs_search_cmd(session, query.ioctl_cmd,
+				(unsigned long) query.ioctl_arg);
+		count = query.error ? 0 : session->scan.count;
+		query.result_count = count;
+		query.truncated = count == session->batch_limit;
+		session->batch_limit = 0;
+
+		for (i = 0; i < count; i++) {
+			tagged[i].query = batch.completed;
+			tagged[i].result = session->results[i];
+		}
+		if (copy_to_user(&results[batch.result_count], tagged,
+					count * sizeof(*tagged))
+				|| copy_to_user(&queries[batch.completed],
+					&query, sizeof(query))) {
+			err = -EFAULT;
+			break;
 		}
+		batch.result_count += count;
 	}
-	rcu_read_unlock();
-	task_unlock(task);
+	kfree(tagged);
+
+	ofs_info("%u/%u queries of batch, %u results\n",
+			batch.completed, batch.query_count, batch.result_count);
+	if (!err && copy_to_user(user_batch, &batch, sizeof(batch))) {
+		err = -EFAULT;
+	}
+	return err;
 }
 
-static void ofs_search_all(ofs_result_filter filter, void *filter_arg) {
-	struct task_struct *task;
+static long ofs_ioctl(struct file *flip, unsigned int ioctl_cmd,
+		unsigned long ioctl_arg) {
+	struct ofs_session *session = flip->private_data;
+	unsigned int value;
+	long err;
 
-	for_each_process(task) {
-		ofs_search(task, filter, filter_arg);
-		if (result_count_ >= OFS_MAX_RESULTS) {
-			return;
-		}
+	mutex_lock(&session->lock);
+	switch (ioctl_cmd) {
+		case OFS_SET_MODE:
+			err = get_user(value, (unsigned int __user *) ioctl_arg)
+				? -EFAULT : ofs_set_mode(session, value);
+			break;
+		case OFS_SET_SCOPE:
+			err = ofs_set_scope(session,
+					(struct ofs_scope __user *) ioctl_arg);
+			break;
+		case OFS_RING_FILL:
+			err = ofs_ring_refill(session);
+			break;
+		case OFS_STATS:
+			err = ofs_get_stats(session,
+					(struct ofs_stats __user *) ioctl_arg);
+			break;
+		case OFS_INDEX_CHECK:
+			err = ofs_check_index((struct ofs_index_check __user *)
+					ioctl_arg);
+			break;
+		case OFS_SUBSCRIBE:
+			err = ofs_subscribe_cmd(session,
+					(struct ofs_subscribe __user *) ioctl_arg);
+			break;
+		case OFS_AGGREGATE:
+			err = ofs_aggregate_cmd(session,
+					(struct ofs_aggregate __user *) ioctl_arg);
+			break;
+		case OFS_TOP:
+			err = ofs_top_cmd(session, (struct ofs_top __user *) ioctl_arg);
+			break;
+		case OFS_BATCH:
+			err = ofs_batch_cmd(session,
+					(struct ofs_batch __user *) ioctl_arg);
+			break;
+		default:
+			err = ofs_search_cmd(session, ioctl_cmd, ioctl_arg);
 	}
+	mutex_unlock(&session->lock);
+	return err;
 }
 
-static void new_search(void) {
-	search_performed_ = 0;
-	result_count_ = 0;
-	read_position_ = 0;
+static inline unsigned int ofs_min(unsigned int a, unsigned int b) {
+	return a <= b ? a : b;
 }
 
-static long ofs_search_open_files_by_pid(pid_t requested_pid) {
-	struct pid *pid;
-	struct task_struct *task;
+/*
+ * Reads results of a streaming search. The scan is continued from the
+ * session's cursor whenever the bounce buffer has been drained; at most
+ * OFS_MAX_RESULTS results are staged in kernel memory at any time.
+ */
+static ssize_t ofs_read_stream(struct ofs_session *session,
+		char __user *buffer, size_t requested_results) {
+	size_t read_results = 0;
+	unsigned int available_results;
+	unsigned int count;
 
-	printk(KERN_INFO "openFileSearch: Searching for open files of " \
-			"process %d\n", requested_pid);
+	while (read_results < requested_results) {
+		available_results = session->scan.count
+			- session->read_position;
+		if (!available_results) {
+			if (session->cursor.done) {
+				break;
+			}
+			ofs_stream_fill(session, min_t(size_t, OFS_MAX_RESULTS,
+						requested_results
+						- read_results));
+			continue;
+		}
 
-	if (!(pid = find_vpid(requested_pid))
-			|| !(task = pid_task(pid, PIDTYPE_PID))) {
-		printk(KERN_WARNING "openFileSearch: PID %d not found\n",
-				requested_pid);
-		return -EINVAL;
+		count = min_t(size_t, available_results,
+				requested_results - read_results);
+		if (copy_to_user(buffer + read_results
+					* sizeof(struct ofs_result),
+					&session->results[session->read_position],
+					count * sizeof(struct ofs_result))) {
+			return -EFAULT;
+		}
+		session->read_position += count;
+		read_results += count;
 	}
 
-	new_search();
-	ofs_search(task, &ofs_no_filter, NULL);
-	search_performed_ = 1;
-	return 0;
+	if (!read_results) {
+		// close search if no (more) results are available
+		session->search_performed = 0;
+	}
+	return read_results;
 }
 
-static long ofs_search_open_files_by_uid(unsigned int uid) {
-	printk(KERN_INFO "openFileSearch: Searching for open files of user %u\n",
-			uid);
+/*
+ * Reads v2 records of a streaming search (OFS_MODE_V2, requested_bytes is a
+ * number of bytes). Only whole records are copied; the scan is continued
+ * whenever the record buffer has been drained.
+ */
+static ssize_t ofs_read_records(struct ofs_session *session,
+		char __user *buffer, size_t requested_bytes) {
+	struct ofs_scan *scan = &session->scan;
+	struct ofs_record *record;
+	size_t read_bytes = 0;
+	unsigned int available_bytes;
+	unsigned int count;
 
-	new_search();
-	ofs_search_all(&ofs_filter_by_uid, &uid);
-	search_performed_ = 1;
-	return 0;
-}
+	for (;;) {
+		available_bytes = scan->records_used - session->read_position;
+		if (!available_bytes) {
+			if (session->cursor.done) {
+				break;
+			}
+			// limited by the size of the record buffer
+			ofs_stream_fill(session, UINT_MAX);
+			continue;
+		}
 
-static long ofs_search_open_files_by_owner(unsigned int owner) {
-	printk(KERN_INFO "openFileSearch: Searching for open files owned by " \
-			"user %u\n", owner);
+		// as many whole records as fit into the rest of the buffer
+		for (count = 0; count < available_bytes; count += record->size) {
+			record = (struct ofs_record *) (scan->records
+					+ session->read_position + count);
+			if (read_bytes + count + record->size > requested_bytes) {
+				break;
+			}
+		}
+		if (!count) {
+			if (!read_bytes) {
+				// the next record does not fit at all
+				return -EINVAL;
+			}
+			break;
+		}
 
-	new_search();
-	ofs_search_all(&ofs_filter_by_owner, &owner);
-	search_performed_ = 1;
-	return 0;
+		if (copy_to_user(buffer + read_bytes,
+					scan->records + session->read_position,
+					count)) {
+			return -EFAULT;
+		}
+		session->read_position += count;
+		read_bytes += count;
+	}
+
+	if (!read_bytes) {
+		// close search if no (more) records are available
+		session->search_performed = 0;
+	}
+	return read_bytes;
 }
 
-static long ofs_search_open_files_by_name(__user char *name) {
-	char *filename;
-	size_t length;
+static inline bool ofs_async_readable(struct ofs_async *async) {
+	return !kfifo_is_empty(&async->fifo) || smp_load_acquire(&async->done)
+		|| !READ_ONCE(async->active);
+}
 
-	if (!(filename = kmalloc(OFS_RESULT_NAME_MAX_LENGTH * sizeof(char),
-					GFP_KERNEL))) {
-		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
-				" for filename\n");
-		return -EIO;
-	}
+/*
+ * Reads results of an asynchronous search. Returns the results produced so
+ * far and waits (without holding the session's lock) if there are none.
+ *
+ * Called with the session's lock held.
+ */
+static ssize_t ofs_read_async(struct ofs_session *session, struct file *flip,
+		char __user *buffer, size_t requested_results) {
+	struct ofs_async *async = &session->async;
+	unsigned int copied;
 
-	if (copy_from_user(filename, name, OFS_RESULT_NAME_MAX_LENGTH
-				* sizeof(char))) {
-		printk(KERN_ERR "openFileSearch: Failed to copy filename to " \
-				"kernel memory\n");
-		return -EIO;
+	while (kfifo_is_empty(&async->fifo)) {
+		if (smp_load_acquire(&async->done)
+				&& kfifo_is_empty(&async->fifo)) {
+			// close search if no more results will be produced
+			session->search_performed = 0;
+			return 0;
+		}
+		if (flip->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+
+		mutex_unlock(&session->lock);
+		if (wait_event_interruptible(async->ready,
+					ofs_async_readable(async))) {
+			mutex_lock(&session->lock);
+			return -ERESTARTSYS;
+		}
+		mutex_lock(&session->lock);
+
+		// the search may have been replaced in the meantime
+		if (!session->search_performed
+				|| !(session->mode & OFS_MODE_ASYNC)
+				|| !async->active) {
+			return -ESRCH;
+		}
 	}
 
-	length = strnlen(filename, OFS_RESULT_NAME_MAX_LENGTH);
-	if (length == OFS_RESULT_NAME_MAX_LENGTH) {
-		// the length must not be higher than max - 1 in order to be
-		// properly NULL-terminated!
-		printk(KERN_WARNING "openFileSearch: Searched filename must " \
-				"not be longer than %u characters " \
-				"(including '\\0').\n",
-				OFS_RESULT_NAME_MAX_LENGTH);
-		return -EINVAL;
+	if (kfifo_to_user(&async->fifo, buffer, min_t(size_t,
+					requested_results, OFS_MAX_RESULTS)
+				* sizeof(struct ofs_result), &copied)) {
+		return -EFAULT;
+	}
+	// continue the search if the worker returned on a full fifo (queuing
+	// a pending or finishing worker again is harmless)
+	if (!smp_load_acquire(&async->done) && !READ_ONCE(async->cancel)) {
+		queue_work(ofs_scan_wq_, &async->work);
 	}
+	return copied / sizeof(struct ofs_result);
+}
 
-	printk(KERN_INFO "openFileSearch: Searching for open files named %s\n",
-			filename);
+static bool ofs_events_pending(struct ofs_subscription *sub) {
+	struct ofs_event_ring *ring;
+	unsigned int cpu;
 
-	new_search();
-	ofs_search_all(&ofs_filter_by_name, filename);
-	search_performed_ = 1;
-	return 0;
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		ring = &sub->rings[cpu];
+		if (smp_load_acquire(&ring->head) != ring->tail
+				|| READ_ONCE(ring->lost) != ring->reported) {
+			return true;
+		}
+	}
+	return false;
 }
 
-static long ofs_ioctl(struct file *flip, unsigned int ioctl_cmd,
-		unsigned long ioctl_arg) {
-	long err;
+/*
+ * Copies the pending events of all rings (starting with a different CPU
+ * every call). Events lost on a CPU are reported by an OFS_EVENT_LOST
+ * event after the events of its ring.
+ *
+ * Returns the number of events copied.
+ */
+static ssize_t ofs_copy_events(struct ofs_subscription *sub,
+		struct ofs_event __user *buffer, size_t requested_events) {
+	struct ofs_event_ring *ring;
+	struct ofs_event lost_event;
+	size_t copied_events = 0;
+	unsigned long lost;
+	unsigned int head;
+	unsigned int cpu;
+	unsigned int i;
 
-	switch (ioctl_cmd) {
-		case OFS_PID:
-			err = ofs_search_open_files_by_pid(
-					*(pid_t *) ioctl_arg);
-			break;
-		case OFS_UID:
-			err = ofs_search_open_files_by_uid(
-					*(unsigned int *) ioctl_arg);
-			break;
-		case OFS_OWNER:
-			err = ofs_search_open_files_by_owner(
-					*(unsigned int *) ioctl_arg);
-			break;
-		case OFS_NAME:
-			err = ofs_search_open_files_by_name((char *) ioctl_arg);
-			break;
-		default:
-			printk(KERN_WARNING "openFileSearch: Unknown search " \
-					"command %u\n", ioctl_cmd);
-			return -EINVAL;
-	}
+	for (i = 0; i < nr_cpu_ids && copied_events < requested_events; i++) {
+		cpu = (sub->next_cpu + i) % nr_cpu_ids;
+		ring = &sub->rings[cpu];
 
-	if (!err) {
-		printk(KERN_INFO "openFileSearch: %d results found\n",
-				result_count_);
+		head = smp_load_acquire(&ring->head);
+		for (; ring->tail != head && copied_events < requested_events;
+				copied_events++) {
+			if (copy_to_user(&buffer[copied_events],
+						&ring->events[ring->tail
+						& (OFS_EVENT_RING_SIZE - 1)],
+						sizeof(struct ofs_event))) {
+				return -EFAULT;
+			}
+			// the slot may be reused by the producer
+			smp_store_release(&ring->tail, ring->tail + 1);
+		}
+
+		lost = READ_ONCE(ring->lost);
+		if (lost != ring->reported && copied_events < requested_events) {
+			memset(&lost_event, 0, sizeof(lost_event));
+			lost_event.type = OFS_EVENT_LOST;
+			lost_event.fd = -1;
+			lost_event.cpu = cpu;
+			lost_event.time_ns = ktime_get_ns();
+			lost_event.lost = lost - ring->reported;
+			if (copy_to_user(&buffer[copied_events++], &lost_event,
+						sizeof(lost_event))) {
+				return -EFAULT;
+			}
+			ring->reported = lost;
+		}
 	}
-	return err;
+	sub->next_cpu = (sub->next_cpu + 1) % nr_cpu_ids;
+	return copied_events;
 }
 
-static inline unsigned int ofs_min(unsigned int a, unsigned int b) {
-	return a <= b ? a : b;
+/*
+ * Reads events of a subscription (struct ofs_event, requested_events is a
+ * number of events). Waits (without holding the session's lock) if there
+ * are none.
+ *
+ * Called with the session's lock held.
+ */
+static ssize_t ofs_read_events(struct ofs_session *session, struct file *flip,
+		char __user *buffer, size_t requested_events) {
+	struct ofs_subscription *sub = &session->sub;
+	ssize_t copied_events;
+
+	while (!(copied_events = ofs_copy_events(sub,
+					(struct ofs_event __user *) buffer,
+					requested_events))
+			&& requested_events) {
+		if (flip->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+
+		mutex_unlock(&session->lock);
+		if (wait_event_interruptible(*sub->wait,
+					!READ_ONCE(sub->active)
+					|| ofs_events_pending(sub))) {
+			mutex_lock(&session->lock);
+			return -ERESTARTSYS;
+		}
+		mutex_lock(&session->lock);
+
+		// the subscription may have ended in the meantime
+		if (!sub->active) {
+			return -ESRCH;
+		}
+	}
+	return copied_events;
 }
 
 // ssize_t = long int, size_t = unsigned long, loff_t = long long 
 static ssize_t ofs_read(struct file *flip, char __user *buffer,
 		size_t requested_results, loff_t *offset) {
+	struct ofs_session *session = flip->private_data;
+	const struct ofs_result *results;
 	unsigned int available_results;
 	unsigned int read_results;
+	ssize_t streamed_results;
+
+	ofs_info("Read request for %lu results\n", requested_results);
 
-	printk(KERN_INFO "openFileSearch: Read request for %lu results\n",
-			requested_results);
+	mutex_lock(&session->lock);
 
 	// require a prior call of ioctl
-	if (!search_performed_) {
+	if (!session->search_performed) {
+		mutex_unlock(&session->lock);
 		printk(KERN_WARNING "openFileSearch: Search has not been " \
 				"performed yet or all results have already " \
 				"been read\n");
 		return -ESRCH;
 	}
 
+	if (session->mode & OFS_MODE_RING) {
+		// results are consumed from the ring
+		mutex_unlock(&session->lock);
+		return -EINVAL;
+	}
+
+	if (session->sub.active) {
+		// requested_results is a number of events
+		streamed_results = ofs_read_events(session, flip, buffer,
+				requested_results);
+		mutex_unlock(&session->lock);
+		return streamed_results;
+	}
+
+	if (session->mode & OFS_MODE_ASYNC) {
+		streamed_results = ofs_read_async(session, flip, buffer,
+				requested_results);
+		mutex_unlock(&session->lock);
+		return streamed_results;
+	}
+
+	if (session->mode & OFS_MODE_V2) {
+		// requested_results is a number of bytes
+		streamed_results = ofs_read_records(session, buffer,
+				requested_results);
+		mutex_unlock(&session->lock);
+		return streamed_results;
+	}
+
+	if (ofs_streaming(session)) {
+		streamed_results = ofs_read_stream(session, buffer,
+				requested_results);
+		mutex_unlock(&session->lock);
+		return streamed_results;
+	}
+
 	// truncate count to number of available results
-	available_results = result_count_ - read_position_;	
+	available_results = session->scan.count - session->read_position;
 	read_results = ofs_min(requested_results, available_results);
+	results = session->snapshot ? session->snapshot->results
+		: session->results;
 
 	if (available_results) {
-		copy_to_user(buffer, &results_[read_position_],
-				read_results * sizeof(struct ofs_result));
-		read_position_ += read_results;
-	} else {	
+		if (copy_to_user(buffer, &results[session->read_position],
+					read_results * sizeof(struct ofs_result))) {
+			mutex_unlock(&session->lock);
+			return -EFAULT;
+		}
+		session->read_position += read_results;
+	} else {
 		// close search if no (more) results are available
-		search_performed_ = 0;
+		session->search_performed = 0;
 	}
+	mutex_unlock(&session->lock);
 
-	printk(KERN_INFO "openFileSearch: %d/%d results read\n", read_results,
+	ofs_info("%d/%d results read\n", read_results,
 			available_results);
 	return read_results;
 }
 
+/*
+ * Allocates the result ring and maps it into user space. The number of
+ * records is derived from the size of the mapping (rounded down to a power
+ * of two). Each session can be mapped only once.
+ *
+ * Called with mmap_sem held, so session->lock must not be taken here:
+ * read() and ioctl() hold it across copy_to_user()/copy_from_user(), which
+ * may fault and take mmap_sem (lock order inversion). The ring is claimed
+ * with cmpxchg() instead and published once it is complete.
+ */
+static int ofs_mmap(struct file *flip, struct vm_area_struct *vma) {
+	struct ofs_session *session = flip->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	struct ofs_ring_header *ring;
+	unsigned long records;
+	int err;
+
+	if (vma->vm_pgoff || size <= OFS_RING_HEADER_SIZE
+			|| !(vma->vm_flags & VM_SHARED)) {
+		return -EINVAL;
+	}
+
+	records = (size - OFS_RING_HEADER_SIZE) / sizeof(struct ofs_result);
+	if (!records || records > OFS_RING_MAX_RECORDS) {
+		return -EINVAL;
+	}
+	records = rounddown_pow_of_two(records);
+
+	if (cmpxchg(&session->ring_claimed, 0, 1)) {
+		return -EBUSY;
+	}
+
+	// vmalloc_user() zeroes the memory and allows mapping it
+	if (!(ring = vmalloc_user(size))) {
+		WRITE_ONCE(session->ring_claimed, 0);
+		printk(KERN_ERR "openFileSearch: Failed to allocate memory " \
+				"for result ring\n");
+		return -ENOMEM;
+	}
+
+	if ((err = remap_vmalloc_range(vma, ring, 0))) {
+		vfree(ring);
+		WRITE_ONCE(session->ring_claimed, 0);
+		return err;
+	}
+
+	ring->size = records;
+	session->ring_records = (struct ofs_result *)
+		((char *) ring + OFS_RING_HEADER_SIZE);
+	session->ring_mask = records - 1;
+	session->ring_producer = 0;
+	// publish the ring after its fields
+	smp_store_release(&session->ring, ring);
+	return 0;
+}
+
+/*
+ * Results of a synchronous search are available as soon as the ioctl
+ * returns, so only asynchronous searches and subscriptions can make read()
+ * block.
+ *
+ * The wait queues belong to the session, so they outlive every search.
+ */
+static unsigned int ofs_poll(struct file *flip, poll_table *wait) {
+	struct ofs_session *session = flip->private_data;
+	struct ofs_async *async = &session->async;
+	struct ofs_subscription *sub = &session->sub;
+
+	if (READ_ONCE(sub->active)) {
+		poll_wait(flip, sub->wait, wait);
+		// the rings live as long as the session
+		if (!READ_ONCE(sub->active) || ofs_events_pending(sub)) {
+			return POLLIN | POLLRDNORM;
+		}
+		return 0;
+	}
+
+	if (!(READ_ONCE(session->mode) & OFS_MODE_ASYNC)) {
+		return POLLIN | POLLRDNORM;
+	}
+
+	poll_wait(flip, &async->ready, wait);
+	if (ofs_async_readable(async)) {
+		return POLLIN | POLLRDNORM;
+	}
+	return 0;
+}
+
 static struct file_operations fops = {
 	.owner = THIS_MODULE, // see https://stackoverflow.com/a/6079839/1948906
 	.open = ofs_open,
 	.release = ofs_release,
 	.unlocked_ioctl = ofs_ioctl,
-	.read = ofs_read
+	.read = ofs_read,
+	.mmap = ofs_mmap,
+	.poll = ofs_poll
 };
 
 static int __init ofs_init(void) {
+	if (!(ofs_scan_wq_ = alloc_workqueue("ofs_scan", WQ_UNBOUND, 0))) {
+		printk(KERN_ERR "openFileSearch: Failed to create workqueue\n");
+		return -ENOMEM;
+	}
+
+	// the module works without the index if the probes are not available
+	if (ofs_index && ofs_index_init()) {
+		printk(KERN_WARNING "openFileSearch: Index disabled\n");
+	}
+
+	ofs_debugfs_init();
+
 	// major = 0 --> use a dynamically created major number
 	// name --> module name in /proc/devices
 	// fops --> supported file operations
@@ -346,6 +4957,9 @@ static int __init ofs_init(void) {
 	if (major_num_ < 0) {
 		printk(KERN_ERR "openFileSearch: Failed to register as \
 				character device (%d)\n", major_num_);
+		debugfs_remove_recursive(ofs_debugfs_);
+		ofs_index_exit();
+		destroy_workqueue(ofs_scan_wq_);
 		return -1;
 	}
 
@@ -358,6 +4972,10 @@ static int __init ofs_init(void) {
 
 static void __exit ofs_exit(void) {
 	unregister_chrdev(major_num_, MODULE_NAME);
+	debugfs_remove_recursive(ofs_debugfs_);
+	ofs_index_exit();
+	ofs_cache_exit();
+	destroy_workqueue(ofs_scan_wq_);
 
 	printk(KERN_INFO "openFileSearch: Unregistered character device with " \
 			"major number %d\n", major_num_);
@@ -36,7 +36,632 @@
 #define OFS_NAME 4
 
 /**
- * Maximum number of results that can be read.
+ * ioctl command for finding all open() instances of a file (like fuser).
+ *
+ * The path is resolved once; open files are matched by inode identity
+ * instead of by name. Also finds the file if it has been opened via a hard
+ * link or a bind mount.
+ *
+ * ioctl argument: char* up to PATH_MAX bytes (null-terminated)
+ *   path of the file
+ */
+#define OFS_INODE 7
+
+/**
+ * ioctl command for finding all open files below a directory, including
+ * files on mounts below it (e.g. to diagnose a busy unmount).
+ *
+ * Matches are checked by dentry and mount ancestry instead of by name.
+ * Only tasks in the caller's mount namespace are searched. The results are
+ * always read via the streaming read path (see OFS_MODE_STREAM), so every
+ * match is returned.
+ *
+ * ioctl argument: char* up to PATH_MAX bytes (null-terminated)
+ *   path of the directory
+ */
+#define OFS_SUBTREE 8
+
+/**
+ * ioctl command for finding all open files matching a predicate program
+ * (see struct ofs_program). All criteria are evaluated in a single pass.
+ *
+ * ioctl argument: struct ofs_program*
+ */
+#define OFS_PROGRAM 9
+
+/*
+ * Operations of a predicate program.
+ *
+ * Leaves compare a field of an open file with the operands of the
+ * instruction, operators combine the results of the preceding leaves.
+ */
+#define OFS_OP_PID		1 // pid == value
+#define OFS_OP_UID		2 // uid of the process == value
+#define OFS_OP_OWNER		3 // owner of the file == value
+#define OFS_OP_TYPE		4 // (mode & S_IFMT) == value, e.g. S_IFREG
+#define OFS_OP_FLAGS		5 // (open flags & value) == value, e.g. O_WRONLY
+#define OFS_OP_SIZE		6 // min <= size <= max
+#define OFS_OP_NAME_PREFIX	7 // name starts with prefix
+#define OFS_OP_AND		8 // pops two operands
+#define OFS_OP_OR		9 // pops two operands
+#define OFS_OP_NOT		10 // pops one operand
+
+/**
+ * Maximum number of instructions of a predicate program.
+ */
+#define OFS_PROGRAM_MAX_INSNS 32
+
+/**
+ * A single instruction of a predicate program.
+ */
+struct ofs_insn {
+	/* The operation (OFS_OP_*) */
+	unsigned int op;
+
+	/* The operand of OFS_OP_PID, UID, OWNER, TYPE and FLAGS */
+	unsigned int value;
+
+	/* The size range of OFS_OP_SIZE (inclusive) */
+	unsigned long long min;
+	unsigned long long max;
+
+	/* The prefix of OFS_OP_NAME_PREFIX (null-terminated) */
+	char prefix[OFS_RESULT_NAME_MAX_LENGTH];
+};
+
+/**
+ * A predicate program in postfix order, e.g. "uid 1000 AND (regular file OR
+ * size >= 1 GB)" is
+ *   UID(1000), TYPE(S_IFREG), SIZE(1 GB, max), OR, AND
+ *
+ * The program is validated once. The kernel evaluates the cheaper operand of
+ * AND/OR first and stops as soon as the result is known.
+ */
+struct ofs_program {
+	/* The number of instructions */
+	unsigned int length;
+
+	/* The instructions */
+	struct ofs_insn insns[OFS_PROGRAM_MAX_INSNS];
+};
+
+/**
+ * ioctl command for setting the mode of all following searches on this open
+ * file. Discards the current search.
+ *
+ * ioctl argument: unsigned int
+ *   bitmask of OFS_MODE_* flags (0 = default mode)
+ */
+#define OFS_SET_MODE 5
+
+/**
+ * Streaming mode: a search ioctl only sets the search criteria. Each read()
+ * continues the scan from where the previous one stopped and produces
+ * results on demand, so the number of results is not limited by
+ * OFS_MAX_RESULTS.
+ */
+#define OFS_MODE_STREAM 0x1
+
+/**
+ * Ring mode: results are written directly into a ring shared with user
+ * space via mmap() (see struct ofs_ring_header). A search ioctl fills the
+ * ring as far as possible, OFS_RING_FILL continues the search once records
+ * have been consumed. read() is not available in this mode.
+ *
+ * Requires a prior mmap() of the open file.
+ */
+#define OFS_MODE_RING 0x2
+
+/**
+ * Parallel mode: full system scans (all searches but OFS_PID) are split
+ * across a number of kernel workers (module parameter ofs_workers) and
+ * their results are merged. Only applies if neither OFS_MODE_STREAM nor
+ * OFS_MODE_RING is set; the order of the results is not defined.
+ *
+ * The workers build names relative to the initial root, so the mode is
+ * rejected (EINVAL) for a caller with a different root (chroot(),
+ * containers). A caller whose root changes after setting the mode is
+ * searched sequentially.
+ */
+#define OFS_MODE_PARALLEL 0x4
+
+/**
+ * Low-latency mode: fd tables are walked in chunks of a few fds; locks are
+ * dropped and the scan reschedules between chunks and between tasks.
+ * Bounds the time locks are held at the cost of some throughput. Can be
+ * combined with all other modes.
+ */
+#define OFS_MODE_LOWLAT 0x8
+
+/**
+ * Asynchronous mode: a search ioctl only queues the search to a kernel
+ * worker and returns right away. read() returns the results produced so far
+ * (at least one) while the scan is still running and blocks until results
+ * are available (or fails with EAGAIN if the file has been opened with
+ * O_NONBLOCK). poll() reports POLLIN as soon as results are available or the
+ * search has finished (read() returns 0).
+ *
+ * The number of results is not limited by OFS_MAX_RESULTS; the worker stops
+ * while OFS_MAX_RESULTS results are pending. Cannot be combined with
+ * OFS_MODE_RING.
+ *
+ * The worker runs in kernel thread context: names are built relative to the
+ * initial root of the system, not to the caller's root (e.g. a chroot or a
+ * container's root file system). Pids are resolved and reported in the
+ * caller's pid namespace.
+ */
+#define OFS_MODE_ASYNC 0x10
+
+/**
+ * Index mode: OFS_UID, OFS_OWNER, OFS_NAME and OFS_INODE searches are served
+ * from an index of all open files maintained by the module instead of
+ * scanning all fd tables (see OFS_INDEX_CHECK). Requires the module
+ * parameter ofs_index=1. Only applies if neither OFS_MODE_STREAM,
+ * OFS_MODE_RING nor OFS_MODE_ASYNC is set; the order of the results is not
+ * defined.
+ */
+#define OFS_MODE_INDEX 0x20
+
+/**
+ * v2 mode: read() returns variable-length records (struct ofs_record) with
+ * the full path, 64-bit size, device, open flags and file position instead
+ * of struct ofs_result. The count of read() is a number of bytes; only
+ * whole records are returned (a buffer of OFS_RECORD_MAX_SIZE bytes always
+ * fits the next record, read() fails with EINVAL if it does not fit).
+ *
+ * Results are always produced on demand like in OFS_MODE_STREAM. Cannot be
+ * combined with OFS_MODE_RING or OFS_MODE_ASYNC.
+ */
+#define OFS_MODE_V2 0x40
+
+/**
+ * De-duplication mode: full system scans walk all threads instead of only
+ * the thread group leaders, so threads with an unshared fd table are
+ * found, and search every fd table only once, so processes sharing a fd
+ * table (CLONE_FILES) are not searched repeatedly. The results of a fd
+ * table carry the pid of the first task found using it. An open file
+ * referred to by several fds of the same fd table (dup()) is returned only
+ * once (for its lowest fd).
+ *
+ * Streaming, ring and asynchronous searches walk a snapshot of the tasks
+ * taken by the search ioctl. v2 records carry the sharing information
+ * (table_users and file_refs). Can be combined with all other modes.
+ */
+#define OFS_MODE_DEDUP 0x80
+
+/**
+ * Typed mode: v2 records of sockets and anonymous pipes carry a typed part
+ * (struct ofs_socket or struct ofs_pipe, see OFS_RECORD_TYPED()) instead of
+ * a path. The type is decided by the mode of the inode; d_path() is not
+ * called for these records (their names socket:[inode_no] and
+ * pipe:[inode_no] follow from inode_no). Requires OFS_MODE_V2.
+ */
+#define OFS_MODE_TYPED 0x100
+
+/**
+ * All valid OFS_MODE_* flags.
+ */
+#define OFS_MODE_ALL (OFS_MODE_STREAM | OFS_MODE_RING | OFS_MODE_PARALLEL \
+		| OFS_MODE_LOWLAT | OFS_MODE_ASYNC | OFS_MODE_INDEX | OFS_MODE_V2 \
+		| OFS_MODE_DEDUP | OFS_MODE_TYPED)
+
+/**
+ * ioctl command for getting the statistics of the current (or last) search
+ * of this open file.
+ *
+ * ioctl argument: struct ofs_stats*
+ */
+#define OFS_STATS 10
+
+/**
+ * Statistics of a search.
+ */
+struct ofs_stats {
+	/* The longest time a lock was held by the scan in nanoseconds */
+	unsigned long long max_lock_ns;
+
+	/* The number of lock sections */
+	unsigned long long lock_sections;
+
+	/* The number of tasks visited (including tasks filtered out) */
+	unsigned long long tasks;
+
+	/* The number of open fds visited */
+	unsigned long long fds;
+
+	/* The number of names built by d_path() */
+	unsigned long long d_path_calls;
+
+	/* The number of open files rejected by the filter */
+	unsigned long long rejected;
+
+	/* The number of names replaced by the short name (path too long) */
+	unsigned long long truncated_names;
+
+	/* The time spent scanning in nanoseconds (sum of all parts of a
+	 * streaming search) */
+	unsigned long long scan_ns;
+};
+
+/**
+ * ioctl command for comparing the open file index (OFS_MODE_INDEX) with a
+ * full scan of all fd tables. Differences found on a busy system may be
+ * caused by fds opened or closed during the scan. Fails with ENOMEM (and
+ * repairs nothing) if the tasks to be scanned cannot be collected.
+ *
+ * ioctl argument: struct ofs_index_check*
+ */
+#define OFS_INDEX_CHECK 11
+
+/**
+ * Result of OFS_INDEX_CHECK.
+ */
+struct ofs_index_check {
+	/* Input: repair the differences (requires CAP_SYS_ADMIN) */
+	unsigned int repair;
+
+	/* The number of open fds found by the scan */
+	unsigned long long scanned;
+
+	/* The number of fds in the index (after repairing) */
+	unsigned long long indexed;
+
+	/* The number of fds found by the scan but missing in the index */
+	unsigned long long missing;
+
+	/* The number of fds in the index not found by the scan */
+	unsigned long long stale;
+
+	/* The number of fds whose inode, pid, uid or owner in the index is
+	 * outdated */
+	unsigned long long mismatched;
+
+	/* The number of open/close events lost by the index */
+	unsigned long long lost;
+};
+
+/**
+ * ioctl command for subscribing to open/close events of files matching the
+ * criteria of a search command (instead of searching). Discards the current
+ * search.
+ *
+ * read() then returns events (struct ofs_event, the count is a number of
+ * events) as they happen and blocks if there are none (or fails with EAGAIN
+ * if the file has been opened with O_NONBLOCK); poll() reports POLLIN when
+ * events are available. The subscription ends with the next search, mode
+ * change or close().
+ *
+ * Events are buffered per CPU; events produced while the buffer of a CPU is
+ * full are dropped and reported by an OFS_EVENT_LOST event.
+ *
+ * ioctl argument: struct ofs_subscribe*
+ */
+#define OFS_SUBSCRIBE 12
+
+/**
+ * Argument of OFS_SUBSCRIBE.
+ */
+struct ofs_subscribe {
+	/* The search command whose criteria are used (e.g. OFS_UID) */
+	unsigned int ioctl_cmd;
+
+	/* The argument of the search command (a pointer, as for ioctl()) */
+	unsigned long long ioctl_arg;
+};
+
+/*
+ * Types of events.
+ */
+#define OFS_EVENT_OPEN	1 // an fd has been installed (open(), dup(), ...)
+#define OFS_EVENT_CLOSE	2 // an fd has been closed (close(), exit, ...)
+#define OFS_EVENT_LOST	3 // events have been dropped
+
+/**
+ * An open/close event of a subscription.
+ */
+struct ofs_event {
+	/* The type of the event (OFS_EVENT_*) */
+	unsigned int type;
+
+	/* The fd (-1 if unknown, e.g. for OFS_EVENT_CLOSE) */
+	int fd;
+
+	/* The CPU the event happened on */
+	unsigned int cpu;
+
+	/* The time of the event (CLOCK_MONOTONIC in nanoseconds) */
+	unsigned long long time_ns;
+
+	/* The number of events dropped on the CPU (OFS_EVENT_LOST only) */
+	unsigned long long lost;
+
+	/* The open file and its process (all but OFS_EVENT_LOST) */
+	struct ofs_result result;
+};
+
+/**
+ * ioctl command for counting the open files matching the criteria of a
+ * search command per uid, per process or per file (instead of returning
+ * every result). Only the groups are copied. Discards the current search.
+ *
+ * The whole system is scanned right away (OFS_MODE_LOWLAT applies, the
+ * other modes do not).
+ *
+ * ioctl argument: struct ofs_aggregate*
+ */
+#define OFS_AGGREGATE 13
+
+/*
+ * Keys of the groups of OFS_AGGREGATE.
+ */
+#define OFS_GROUP_BY_UID	1 // uid of the process
+#define OFS_GROUP_BY_PID	2 // pid of the process
+#define OFS_GROUP_BY_FILE	3 // device and inode number of the file
+
+/**
+ * Maximum number of groups of OFS_AGGREGATE.
+ */
+#define OFS_MAX_GROUPS (1 << 16)
+
+/**
+ * A group of open files.
+ */
+struct ofs_group {
+	/* The uid, the pid or the inode number */
+	unsigned long long key;
+
+	/* The number of open files (fds) of the group */
+	unsigned long long count;
+
+	/* The sum of the sizes of the open files in bytes */
+	unsigned long long total_size;
+
+	/* The device of the file (st_dev, OFS_GROUP_BY_FILE only) */
+	unsigned int dev;
+};
+
+/**
+ * Argument of OFS_AGGREGATE.
+ */
+struct ofs_aggregate {
+	/* Input: the search command whose criteria are used (e.g. OFS_UID) */
+	unsigned int ioctl_cmd;
+
+	/* Input: the argument of the search command (as for ioctl()) */
+	unsigned long long ioctl_arg;
+
+	/* Input: the key of the groups (OFS_GROUP_BY_*) */
+	unsigned int group_by;
+
+	/* Input: the number of groups of the buffer (1-OFS_MAX_GROUPS) */
+	unsigned int capacity;
+
+	/* Input: the buffer of the groups (struct ofs_group*) */
+	unsigned long long groups;
+
+	/* Output: the number of groups written to the buffer */
+	unsigned int group_count;
+
+	/* Output: the number of matching open files */
+	unsigned long long matches;
+
+	/* Output: the number of matching open files not counted because all
+	 * groups were in use */
+	unsigned long long dropped;
+};
+
+/**
+ * ioctl command for returning only the k largest open files or the k
+ * processes with the most open files matching the criteria of a search
+ * command (in descending order). Discards the current search.
+ *
+ * The whole system is scanned right away (OFS_MODE_LOWLAT applies, the
+ * other modes do not).
+ *
+ * ioctl argument: struct ofs_top*
+ */
+#define OFS_TOP 14
+
+/*
+ * Ranks of OFS_TOP.
+ */
+#define OFS_RANK_SIZE	1 // size of the file (one entry per open file)
+#define OFS_RANK_FDS	2 // number of matching open files of a process
+
+/**
+ * Maximum k of OFS_TOP.
+ */
+#define OFS_MAX_TOP 4096
+
+/**
+ * An entry of the result of OFS_TOP.
+ *
+ * With OFS_RANK_FDS the result describes the process: only pid, uid and
+ * name (the command name of the process) are set.
+ */
+struct ofs_ranked {
+	/* The size in bytes or the number of open files */
+	unsigned long long rank;
+
+	/* The open file or process */
+	struct ofs_result result;
+};
+
+/**
+ * Argument of OFS_TOP.
+ */
+struct ofs_top {
+	/* Input: the search command whose criteria are used (e.g. OFS_UID) */
+	unsigned int ioctl_cmd;
+
+	/* Input: the argument of the search command (as for ioctl()) */
+	unsigned long long ioctl_arg;
+
+	/* Input: the rank (OFS_RANK_*) */
+	unsigned int rank_by;
+
+	/* Input: the number of entries of the buffer (1-OFS_MAX_TOP) */
+	unsigned int k;
+
+	/* Input: the buffer of the entries (struct ofs_ranked*) */
+	unsigned long long results;
+
+	/* Output: the number of entries written to the buffer */
+	unsigned int count;
+
+	/* Output: the number of matching open files */
+	unsigned long long matches;
+};
+
+/**
+ * ioctl command for performing a batch of search commands (e.g. OFS_PID for
+ * hundreds of processes) in a single call. The results of all queries are
+ * copied to a single buffer, each tagged with the index of its query.
+ * Discards the current search.
+ *
+ * Every query is performed right away like in the default mode (at most
+ * OFS_MAX_RESULTS results per query; OFS_MODE_LOWLAT, OFS_MODE_PARALLEL and
+ * OFS_MODE_INDEX apply, the other modes do not). A failing query does not
+ * fail the batch, its error is returned in struct ofs_batch_query.
+ *
+ * ioctl argument: struct ofs_batch*
+ */
+#define OFS_BATCH 15
+
+/**
+ * Maximum number of queries of OFS_BATCH.
+ */
+#define OFS_MAX_BATCH 4096
+
+/**
+ * A query of OFS_BATCH.
+ */
+struct ofs_batch_query {
+	/* Input: the search command (e.g. OFS_PID) */
+	unsigned int ioctl_cmd;
+
+	/* Input: the argument of the search command (as for ioctl()) */
+	unsigned long long ioctl_arg;
+
+	/* Output: 0 or the (negative) error of the search command */
+	int error;
+
+	/* Output: the number of results of the query */
+	unsigned int result_count;
+
+	/* Output: set if the query may have more results than returned */
+	unsigned int truncated;
+};
+
+/**
+ * A result of OFS_BATCH.
+ */
+struct ofs_batch_result {
+	/* The index of the query that produced the result */
+	unsigned int query;
+
+	/* The result */
+	struct ofs_result result;
+};
+
+/**
+ * Argument of OFS_BATCH.
+ */
+struct ofs_batch {
+	/* Input: the number of queries (1-OFS_MAX_BATCH) */
+	unsigned int query_count;
+
+	/* Input: the queries (struct ofs_batch_query*) */
+	unsigned long long queries;
+
+	/* Input: the number of results of the buffer */
+	unsigned int capacity;
+
+	/* Input: the buffer of the results (struct ofs_batch_result*) */
+	unsigned long long results;
+
+	/* Output: the number of queries performed (the remaining queries did
+	 * not fit into the buffer) */
+	unsigned int completed;
+
+	/* Output: the number of results written to the buffer */
+	unsigned int result_count;
+};
+
+/**
+ * ioctl command for restricting all following searches on this open file
+ * to the tasks of a pid namespace and/or a cgroup (e.g. of a container).
+ * Tasks outside the scope are skipped before their fd table is touched.
+ * Discards the current search.
+ *
+ * Pids are always reported as seen from the caller's pid namespace (0 if
+ * a task is not visible there).
+ *
+ * ioctl argument: struct ofs_scope*
+ */
+#define OFS_SET_SCOPE 16
+
+/**
+ * Argument of OFS_SET_SCOPE. A scope with both fields 0 removes the scope.
+ */
+struct ofs_scope {
+	/* A process whose pid namespace (including its descendants) the
+	 * searches are restricted to (0 = any pid namespace) */
+	int pid;
+
+	/* The path of a cgroup v2 relative to the root of the cgroup2 file
+	 * system (e.g. "/system.slice/docker-1234.scope") whose tasks
+	 * (including descendant cgroups) the searches are restricted to
+	 * (char*, 0 = any cgroup) */
+	unsigned long long cgroup;
+};
+
+/**
+ * ioctl command for continuing a search in ring mode. Fills the free
+ * records of the ring.
+ *
+ * ioctl argument: none
+ * return value: number of records added to the ring
+ */
+#define OFS_RING_FILL 6
+
+/**
+ * Offset of the first record of the ring within the mapping.
+ */
+#define OFS_RING_HEADER_SIZE 4096
+
+/**
+ * Maximum number of records of the ring.
+ */
+#define OFS_RING_MAX_RECORDS (1 << 20)
+
+/**
+ * Header of the result ring at the start of the mapping. The records
+ * (struct ofs_result) follow at offset OFS_RING_HEADER_SIZE.
+ *
+ * mmap() length: OFS_RING_HEADER_SIZE + n * sizeof(struct ofs_result)
+ * with PROT_READ | PROT_WRITE and MAP_SHARED. The number of records is
+ * rounded down to a power of two.
+ *
+ * Indices are free running: record i is stored at records[i % size].
+ * Records in [consumer, producer) are valid.
+ */
+struct ofs_ring_header {
+	/* The number of records of the ring (written by the kernel) */
+	unsigned int size;
+
+	/* The index of the next record to be produced (written by the kernel) */
+	unsigned int producer;
+
+	/* The index of the next record to be consumed (written by user space) */
+	unsigned int consumer;
+
+	/* Set by the kernel when all results have been produced */
+	unsigned int done;
+};
+
+/**
+ * Maximum number of results that can be read (except in streaming mode).
  */
 #define OFS_MAX_RESULTS 256
 
@@ -0,0 +1,559 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/fdtable.h>
+#include <linux/fs.h>
+#include <linux/dcache.h>
+#include <linux/namei.h>
+#include <linux/path.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+/*
+ * Microbenchmarks of the kernel primitives openFileSearch depends on.
+ *
+ * Every primitive has a file in /sys/kernel/debug/microbench; writing
+ * "<iterations> [arg]" to it runs the benchmark in the writer's context.
+ * The results of all runs are listed in /sys/kernel/debug/microbench/results
+ * (ns per unit, percentiles of the samples), writing to reset clears them.
+ */
+
+#define MODULE_NAME "microbench"
+
+MODULE_AUTHOR("Marcel Binder <binder4@hm.edu>");
+MODULE_LICENSE("GPL");
+
+#define MB_MAX_ITERATIONS 1000000
+#define MB_MAX_RUNS 64
+#define MB_ARG_MAX 256
+
+/**
+ * The result of one run of a primitive.
+ */
+struct mb_run {
+	struct list_head list;
+	const char *primitive;
+	char arg[MB_ARG_MAX];
+	unsigned int samples;
+	// the samples consist of units (e.g. tasks of a traversal)
+	const char *unit;
+	unsigned long long units;
+	unsigned long long total_ns;
+	unsigned long long p50_ns;
+	unsigned long long p90_ns;
+	unsigned long long p99_ns;
+	unsigned long long max_ns;
+};
+
+/**
+ * A benchmarked primitive: run() takes iterations samples (ns) and counts
+ * the units they consist of.
+ */
+struct mb_primitive {
+	const char *name;
+	const char *unit;
+	int (*run)(const char *arg, u64 *samples, unsigned int iterations,
+			unsigned long long *units);
+};
+
+// the runs, oldest first (protected by mb_lock_, which also serializes runs)
+static LIST_HEAD(mb_runs_);
+static unsigned int mb_run_count_;
+static DEFINE_MUTEX(mb_lock_);
+
+static struct dentry *mb_debugfs_;
+
+/*
+ * Yields between samples (outside of the timed section) and stops long runs
+ * of killed writers.
+ */
+static int mb_next_sample(void) {
+	cond_resched();
+	return fatal_signal_pending(current) ? -EINTR : 0;
+}
+
+/*
+ * Two back-to-back ktime_get_ns() calls: the overhead included in every
+ * sample.
+ */
+static int mb_clock(const char *arg, u64 *samples, unsigned int iterations,
+		unsigned long long *units) {
+	unsigned int i;
+	u64 start;
+
+	for (i = 0; i < iterations; i++) {
+		start = ktime_get_ns();
+		samples[i] = ktime_get_ns() - start;
+	}
+	*units = iterations;
+	return 0;
+}
+
+/*
+ * One sample = one for_each_process() traversal under RCU (arg "threads":
+ * for_each_process_thread()).
+ */
+static int mb_for_each_process(const char *arg, u64 *samples,
+		unsigned int iterations, unsigned long long *units) {
+	unsigned int i;
+	struct task_struct *process;
+	struct task_struct *task;
+	bool threads = strcmp(arg, "threads") == 0;
+	unsigned long long count;
+	u64 start;
+	int err;
+
+	if (*arg && !threads) {
+		return -EINVAL;
+	}
+	for (i = 0; i < iterations; i++) {
+		if ((err = mb_next_sample())) {
+			return err;
+		}
+		count = 0;
+		start = ktime_get_ns();
+		rcu_read_lock();
+		if (threads) {
+			for_each_process_thread(process, task) {
+				count++;
+			}
+		} else {
+			for_each_process(task) {
+				count++;
+			}
+		}
+		rcu_read_unlock();
+		samples[i] = ktime_get_ns() - start;
+		*units += count;
+	}
+	return 0;
+}
+
+/*
+ * Walks the fd table of a task like ofs_search(): task_lock(),
+ * files_fdtable() under RCU, every open fd dereferenced. Returns the number
+ * of open fds.
+ */
+static unsigned long long mb_walk_fdtable(struct task_struct *task) {
+	unsigned int fd;
+	struct files_struct *files;
+	struct fdtable *fdt;
+	struct file *file;
+	unsigned long long count = 0;
+
+	task_lock(task);
+	files = task->files;
+	if (files) {
+		rcu_read_lock();
+		fdt = files_fdtable(files);
+		for (fd = 0; fd < fdt->max_fds; fd++) {
+			if (fd_is_open(fd, fdt)) {
+				file = rcu_dereference_raw(fdt->fd[fd]);
+				if (file) {
+					count++;
+				}
+			}
+		}
+		rcu_read_unlock();
+	}
+	task_unlock(task);
+	return count;
+}
+
+/*
+ * One sample = the walk of the fd tables of all processes (arg pid: of
+ * this process only).
+ */
+static int mb_fdtable(const char *arg, u64 *samples, unsigned int iterations,
+		unsigned long long *units) {
+	unsigned int i;
+	struct task_struct *task = NULL;
+	unsigned long long count;
+	pid_t pid = 0;
+	u64 start;
+	int err = 0;
+
+	if (*arg) {
+		if (kstrtoint(arg, 10, &pid) || pid <= 0) {
+			return -EINVAL;
+		}
+		rcu_read_lock();
+		if ((task = pid_task(find_vpid(pid), PIDTYPE_PID))) {
+			get_task_struct(task);
+		}
+		rcu_read_unlock();
+		if (!task) {
+			return -ESRCH;
+		}
+	}
+
+	for (i = 0; i < iterations; i++) {
+		if ((err = mb_next_sample())) {
+			break;
+		}
+		count = 0;
+		start = ktime_get_ns();
+		if (task) {
+			count = mb_walk_fdtable(task);
+		} else {
+			struct task_struct *process;
+
+			rcu_read_lock();
+			for_each_process(process) {
+				count += mb_walk_fdtable(process);
+			}
+			rcu_read_unlock();
+		}
+		samples[i] = ktime_get_ns() - start;
+		*units += count;
+	}
+
+	if (task) {
+		put_task_struct(task);
+	}
+	return err;
+}
+
+/*
+ * One sample = d_path() of the path given as arg (the depth is the number
+ * of its components).
+ */
+static int mb_d_path(const char *arg, u64 *samples, unsigned int iterations,
+		unsigned long long *units) {
+	unsigned int i;
+	struct path path;
+	char *buffer;
+	char *name;
+	u64 start;
+	int err;
+
+	if (!(buffer = kmalloc(PATH_MAX, GFP_KERNEL))) {
+		return -ENOMEM;
+	}
+	if ((err = kern_path(arg, LOOKUP_FOLLOW, &path))) {
+		kfree(buffer);
+		return err;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		if ((err = mb_next_sample())) {
+			break;
+		}
+		start = ktime_get_ns();
+		name = d_path(&path, buffer, PATH_MAX);
+		samples[i] = ktime_get_ns() - start;
+		if (IS_ERR(name)) {
+			err = PTR_ERR(name);
+			break;
+		}
+		(*units)++;
+	}
+
+	path_put(&path);
+	kfree(buffer);
+	return err;
+}
+
+/*
+ * One sample = inode_lock_shared() and inode_unlock_shared() of the inode
+ * of the path given as arg (uncontended unless other writers hold it).
+ */
+static int mb_inode_lock(const char *arg, u64 *samples,
+		unsigned int iterations, unsigned long long *units) {
+	unsigned int i;
+	struct path path;
+	struct inode *inode;
+	u64 start;
+	int err;
+
+	if ((err = kern_path(arg, LOOKUP_FOLLOW, &path))) {
+		return err;
+	}
+	inode = d_inode(path.dentry);
+
+	for (i = 0; i < iterations; i++) {
+		if ((err = mb_next_sample())) {
+			break;
+		}
+		start = ktime_get_ns();
+		inode_lock_shared(inode);
+		inode_unlock_shared(inode);
+		samples[i] = ktime_get_ns() - start;
+		(*units)++;
+	}
+
+	path_put(&path);
+	return err;
+}
+
+/*
+ * One sample = copy_to_user() of arg bytes (e.g. a read() batch of
+ * results) into a buffer mapped into the writer for the run. The buffer is
+ * faulted in before the first sample.
+ */
+static int mb_copy_to_user(const char *arg, u64 *samples,
+		unsigned int iterations, unsigned long long *units) {
+	unsigned int i;
+	unsigned int bytes;
+	unsigned long length;
+	unsigned long address;
+	void *buffer;
+	u64 start;
+	int err = 0;
+
+	if (kstrtouint(arg, 10, &bytes) || !bytes || bytes > (64 << 20)) {
+		return -EINVAL;
+	}
+	if (!(buffer = vzalloc(bytes))) {
+		return -ENOMEM;
+	}
+	length = PAGE_ALIGN(bytes);
+	address = vm_mmap(NULL, 0, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, 0);
+	if (IS_ERR_VALUE(address)) {
+		vfree(buffer);
+		return (int) address;
+	}
+
+	if (copy_to_user((void __user *) address, buffer, bytes)) {
+		err = -EFAULT;
+	}
+	for (i = 0; !err && i < iterations; i++) {
+		if ((err = mb_next_sample())) {
+			break;
+		}
+		start = ktime_get_ns();
+		if (copy_to_user((void __user *) address, buffer, bytes)) {
+			err = -EFAULT;
+		}
+		samples[i] = ktime_get_ns() - start;
+		*units += bytes;
+	}
+
+	vm_munmap(address, length);
+	vfree(buffer);
+	return err;
+}
+
+static const struct mb_primitive mb_primitives_[] = {
+	{ "clock", "call", mb_clock },
+	{ "for_each_process", "task", mb_for_each_process },
+	{ "fdtable", "fd", mb_fdtable },
+	{ "d_path", "call", mb_d_path },
+	{ "inode_lock", "lock", mb_inode_lock },
+	{ "copy_to_user", "byte", mb_copy_to_user },
+};
+
+static int mb_compare_ns(const void *a, const void *b) {
+	u64 x = *(const u64 *) a;
+	u64 y = *(const u64 *) b;
+	return x < y ? -1 : x > y;
+}
+
+// nearest rank of sorted samples
+static u64 mb_percentile(const u64 *samples, unsigned int count,
+		unsigned int p) {
+	return samples[((u64) p * (count - 1) + 50) / 100];
+}
+
+/*
+ * Runs a primitive and appends its result to the runs (the oldest run is
+ * dropped beyond MB_MAX_RUNS).
+ */
+static int mb_run(const struct mb_primitive *primitive,
+		unsigned int iterations, const char *arg) {
+	unsigned int i;
+	struct mb_run *run;
+	struct mb_run *oldest;
+	u64 *samples;
+	int err;
+
+	if (!iterations || iterations > MB_MAX_ITERATIONS) {
+		return -EINVAL;
+	}
+	if (!(run = kzalloc(sizeof(*run), GFP_KERNEL))) {
+		return -ENOMEM;
+	}
+	// vmalloc: up to 8 MB of samples
+	if (!(samples = vmalloc(iterations * sizeof(*samples)))) {
+		kfree(run);
+		return -ENOMEM;
+	}
+	run->primitive = primitive->name;
+	run->unit = primitive->unit;
+	run->samples = iterations;
+	strlcpy(run->arg, arg, sizeof(run->arg));
+
+	mutex_lock(&mb_lock_);
+	err = primitive->run(arg, samples, iterations, &run->units);
+	if (err) {
+		mutex_unlock(&mb_lock_);
+		printk(KERN_WARNING "microbench: %s %s failed: %d\n",
+				primitive->name, arg, err);
+		vfree(samples);
+		kfree(run);
+		return err;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		run->total_ns += samples[i];
+	}
+	sort(samples, iterations, sizeof(*samples), mb_compare_ns, NULL);
+	run->p50_ns = mb_percentile(samples, iterations, 50);
+	run->p90_ns = mb_percentile(samples, iterations, 90);
+	run->p99_ns = mb_percentile(samples, iterations, 99);
+	run->max_ns = samples[iterations - 1];
+
+	list_add_tail(&run->list, &mb_runs_);
+	if (++mb_run_count_ > MB_MAX_RUNS) {
+		oldest = list_first_entry(&mb_runs_, struct mb_run, list);
+		list_del(&oldest->list);
+		kfree(oldest);
+		mb_run_count_--;
+	}
+	mutex_unlock(&mb_lock_);
+
+	vfree(samples);
+	return 0;
+}
+
+/*
+ * Writing "<iterations> [arg]" to the file of a primitive runs it.
+ */
+static ssize_t mb_debugfs_run_write(struct file *flip,
+		const char __user *buffer, size_t count, loff_t *offset) {
+	const struct mb_primitive *primitive = flip->private_data;
+	char command[MB_ARG_MAX + 16];
+	char *arg;
+	char *token;
+	unsigned int iterations;
+	int err;
+
+	if (count >= sizeof(command)) {
+		return -EINVAL;
+	}
+	if (copy_from_user(command, buffer, count)) {
+		return -EFAULT;
+	}
+	command[count] = '\0';
+
+	arg = strim(command);
+	token = strsep(&arg, " \t");
+	if (kstrtouint(token, 10, &iterations)) {
+		return -EINVAL;
+	}
+	arg = arg ? skip_spaces(arg) : "";
+
+	if ((err = mb_run(primitive, iterations, arg))) {
+		return err;
+	}
+	return count;
+}
+
+static const struct file_operations mb_debugfs_run_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = mb_debugfs_run_write,
+};
+
+static int mb_debugfs_results_show(struct seq_file *m, void *data) {
+	struct mb_run *run;
+	unsigned long long per_unit;
+
+	seq_puts(m, "primitive        arg                   samples unit  " \
+			"ns/unit          mean      p50      p90      p99      max\n");
+	mutex_lock(&mb_lock_);
+	list_for_each_entry(run, &mb_runs_, list) {
+		// in thousandths of a ns (e.g. copy_to_user() per byte)
+		per_unit = run->units ? run->total_ns * 1000 / run->units : 0;
+		seq_printf(m, "%-16s %-20s %8u %-5s %9llu.%03llu %9llu %8llu " \
+				"%8llu %8llu %8llu\n", run->primitive,
+				*run->arg ? run->arg : "-", run->samples, run->unit,
+				per_unit / 1000, per_unit % 1000,
+				run->total_ns / run->samples, run->p50_ns,
+				run->p90_ns, run->p99_ns, run->max_ns);
+	}
+	mutex_unlock(&mb_lock_);
+	return 0;
+}
+
+static int mb_debugfs_results_open(struct inode *inode, struct file *flip) {
+	return single_open(flip, mb_debugfs_results_show, NULL);
+}
+
+static const struct file_operations mb_debugfs_results_fops = {
+	.owner = THIS_MODULE,
+	.open = mb_debugfs_results_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void mb_clear_runs(void) {
+	struct mb_run *run;
+	struct mb_run *next;
+
+	list_for_each_entry_safe(run, next, &mb_runs_, list) {
+		list_del(&run->list);
+		kfree(run);
+	}
+	mb_run_count_ = 0;
+}
+
+/*
+ * Writing anything to the reset file clears the results.
+ */
+static ssize_t mb_debugfs_reset_write(struct file *flip,
+		const char __user *buffer, size_t count, loff_t *offset) {
+	mutex_lock(&mb_lock_);
+	mb_clear_runs();
+	mutex_unlock(&mb_lock_);
+	return count;
+}
+
+static const struct file_operations mb_debugfs_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = mb_debugfs_reset_write,
+};
+
+static int __init set_up(void) {
+	unsigned int i;
+
+	mb_debugfs_ = debugfs_create_dir(MODULE_NAME, NULL);
+	if (IS_ERR_OR_NULL(mb_debugfs_)) {
+		printk(KERN_ERR "microbench: debugfs not available\n");
+		return mb_debugfs_ ? PTR_ERR(mb_debugfs_) : -ENOMEM;
+	}
+	for (i = 0; i < ARRAY_SIZE(mb_primitives_); i++) {
+		debugfs_create_file(mb_primitives_[i].name, 0200, mb_debugfs_,
+				(void *) &mb_primitives_[i], &mb_debugfs_run_fops);
+	}
+	debugfs_create_file("results", 0444, mb_debugfs_, NULL,
+			&mb_debugfs_results_fops);
+	debugfs_create_file("reset", 0200, mb_debugfs_, NULL,
+			&mb_debugfs_reset_fops);
+	printk(KERN_INFO "microbench: loaded\n");
+	return 0;
+}
+
+static void __exit tear_down(void) {
+	debugfs_remove_recursive(mb_debugfs_);
+	mutex_lock(&mb_lock_);
+	mb_clear_runs();
+	mutex_unlock(&mb_lock_);
+	printk(KERN_INFO "microbench: unloaded\n");
+}
+
+module_init(set_up);
+module_exit(tear_down);